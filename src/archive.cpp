@@ -0,0 +1,279 @@
+/* npd project: archive.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// ListingArchive class implementation
+
+#include <iostream>
+#include <cstring>  // memcmp
+
+#if !defined(_WIN32)
+#include <unistd.h>  // pread, pwrite
+#endif
+
+#include "archive.h"
+#include "checksum.h"
+
+static void Put16(std::string &out, uint16_t x)
+{
+    out.push_back((char)(x & 0xFF));
+    out.push_back((char)(x >> 8));
+}
+
+static void Put32(std::string &out, uint32_t x)
+{
+    Put16(out, (uint16_t)(x & 0xFFFF));
+    Put16(out, (uint16_t)(x >> 16));
+}
+
+static void Put64(std::string &out, uint64_t x)
+{
+    Put32(out, (uint32_t)(x & 0xFFFFFFFF));
+    Put32(out, (uint32_t)(x >> 32));
+}
+
+static uint32_t Get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t Get64(const uint8_t *p)
+{
+    return Get32(p) | ((uint64_t)Get32(p + 4) << 32);
+}
+
+static uint32_t Crc32(const std::string &data)
+{
+    return ChecksumVerifier::UpdateCrc32(0xFFFFFFFF, (const uint8_t *)data.data(), data.size()) ^ 0xFFFFFFFF;
+}
+
+ListingArchive::ListingArchive()
+: m_pFile(NULL), m_end(0)
+{
+}
+
+ListingArchive::~ListingArchive()
+{
+    if (m_pFile != NULL)
+    {
+        fclose(m_pFile);
+    }
+}
+
+/// @brief Create an archive for 'count' listings
+bool ListingArchive::Create(const std::string &filename, size_t count)
+{
+    m_filename = filename;
+    m_pFile = fopen(filename.c_str(), "w+b");
+    if (m_pFile == NULL)
+    {
+        std::cerr << "Error writing file " << filename << std::endl;
+        return false;
+    }
+    m_entries.assign(count, Entry());
+    m_written.assign(count, 0);
+
+    std::string header("NPDA");
+    Put16(header, FormatVersion);
+    Put16(header, 0);
+    Put64(header, 0);
+    m_end = HeaderSize;
+    return WriteAt(0, header.data(), header.size());
+}
+
+/// @brief Write a listing in its index slot. Thread safe, one call per slot
+bool ListingArchive::Write(size_t slot, const std::string &name, const std::string &data)
+{
+    Entry &entry = m_entries.at(slot);
+    entry.name = name;
+    entry.length = data.size();
+    entry.crc = Crc32(data);
+    entry.offset = m_end.fetch_add(data.size());
+    m_written[slot] = 1;
+    return WriteAt(entry.offset, data.data(), data.size());
+}
+
+/// @brief Write the index of the written slots and the trailer
+bool ListingArchive::Close()
+{
+    std::string index;
+    uint32_t count = 0;
+    for (size_t i = 0; i < m_entries.size(); i++)
+    {
+        if (!m_written[i])
+        {
+            continue;
+        }
+        const Entry &entry = m_entries[i];
+        Put64(index, entry.offset);
+        Put64(index, entry.length);
+        Put32(index, entry.crc);
+        Put32(index, (uint32_t)entry.name.size());
+        index.append(entry.name);
+        count++;
+    }
+
+    uint64_t indexOffset = m_end;
+    std::string trailer;
+    Put64(trailer, indexOffset);
+    Put64(trailer, index.size());
+    Put32(trailer, count);
+    trailer.append("NPAE");
+    index.append(trailer);
+    bool written = WriteAt(indexOffset, index.data(), index.size());
+    written = (fclose(m_pFile) == 0) && written;
+    m_pFile = NULL;
+    if (!written)
+    {
+        std::cerr << "Error writing file " << m_filename << std::endl;
+    }
+    return written;
+}
+
+/// @brief Open an archive and read its index
+bool ListingArchive::Open(const std::string &filename)
+{
+    m_filename = filename;
+    m_entries.clear();
+    m_pFile = fopen(filename.c_str(), "rb");
+    if (m_pFile == NULL)
+    {
+        std::cerr << "Error reading file '" << filename << "'\n";
+        return false;
+    }
+
+    uint8_t header[HeaderSize];
+    uint8_t trailer[TrailerSize];
+    bool valid = (fseek(m_pFile, 0, SEEK_END) == 0);
+    long size = valid ? ftell(m_pFile) : 0;
+    valid = valid && (size >= (long)(HeaderSize + TrailerSize)) &&
+            ReadAt(0, header, HeaderSize) && ReadAt(size - TrailerSize, trailer, TrailerSize) &&
+            (memcmp(header, "NPDA", 4) == 0) && ((header[4] | (header[5] << 8)) == FormatVersion) &&
+            (memcmp(trailer + 20, "NPAE", 4) == 0);
+    uint64_t indexOffset = valid ? Get64(trailer) : 0;
+    uint64_t indexSize = valid ? Get64(trailer + 8) : 0;
+    uint32_t count = valid ? Get32(trailer + 16) : 0;
+    valid = valid && (indexOffset >= HeaderSize) && (indexOffset + indexSize + TrailerSize == (uint64_t)size);
+
+    std::vector<uint8_t> index(valid ? indexSize : 0);
+    valid = valid && ReadAt(indexOffset, index.data(), index.size());
+    size_t p = 0;
+    for (uint32_t i = 0; valid && (i < count); i++)
+    {
+        Entry entry;
+        valid = (p + 24 <= index.size());
+        if (valid)
+        {
+            entry.offset = Get64(&index[p]);
+            entry.length = Get64(&index[p + 8]);
+            entry.crc = Get32(&index[p + 16]);
+            uint32_t nameSize = Get32(&index[p + 20]);
+            p += 24;
+            valid = (nameSize <= index.size() - p) && (entry.offset >= HeaderSize) &&
+                    (entry.length <= indexOffset - entry.offset);
+            if (valid)
+            {
+                entry.name.assign((const char *)&index[p], nameSize);
+                p += nameSize;
+                m_entries.push_back(entry);
+            }
+        }
+    }
+    if (!valid)
+    {
+        std::cerr << "Invalid archive file '" << filename << "'\n";
+        m_entries.clear();
+        return false;
+    }
+    return true;
+}
+
+/// @brief First listing of a name
+/// @return NULL if none
+const ListingArchive::Entry *ListingArchive::Find(const std::string &name) const
+{
+    for (size_t i = 0; i < m_entries.size(); i++)
+    {
+        if (m_entries[i].name == name)
+        {
+            return &m_entries[i];
+        }
+    }
+    return NULL;
+}
+
+/// @brief Read a listing and check its CRC
+bool ListingArchive::Read(const Entry &entry, std::string &data) const
+{
+    data.assign(entry.length, '\0');
+    if (!ReadAt(entry.offset, &data[0], data.size()))
+    {
+        std::cerr << "Error reading file '" << m_filename << "'\n";
+        return false;
+    }
+    if (Crc32(data) != entry.crc)
+    {
+        std::cerr << "CRC error in " << entry.name << " of " << m_filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ListingArchive::WriteAt(uint64_t offset, const void *pData, size_t size)
+{
+#if !defined(_WIN32)
+    const char *p = (const char *)pData;
+    while (size > 0)
+    {
+        ssize_t written = pwrite(fileno(m_pFile), p, size, (off_t)offset);
+        if (written <= 0)
+        {
+            return false;
+        }
+        p += written;
+        offset += written;
+        size -= written;
+    }
+    return true;
+#else
+    std::lock_guard<std::mutex> lock(m_fileMutex);
+    return (_fseeki64(m_pFile, offset, SEEK_SET) == 0) && (fwrite(pData, 1, size, m_pFile) == size);
+#endif
+}
+
+bool ListingArchive::ReadAt(uint64_t offset, void *pData, size_t size) const
+{
+#if !defined(_WIN32)
+    char *p = (char *)pData;
+    while (size > 0)
+    {
+        ssize_t done = pread(fileno(m_pFile), p, size, (off_t)offset);
+        if (done <= 0)
+        {
+            return false;
+        }
+        p += done;
+        offset += done;
+        size -= done;
+    }
+    return true;
+#else
+    std::lock_guard<std::mutex> lock(m_fileMutex);
+    return (_fseeki64(m_pFile, offset, SEEK_SET) == 0) && (fread(pData, 1, size, m_pFile) == size);
+#endif
+}
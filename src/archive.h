@@ -0,0 +1,85 @@
+/* npd project: archive.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+/// @brief Container of the listings of a batch
+///
+/// File layout (version 1). All integers are little endian.
+///   Header (16 bytes)       "NPDA", u16 version, u16 reserved, u64 reserved
+///   Listings                back to back, in the order they were written
+///   Index                   per listing: u64 offset, u64 length, u32 CRC-32,
+///                           u32 name length, name. In batch order
+///   Trailer (24 bytes)      u64 index offset, u64 index size,
+///                           u32 listing count, "NPAE"
+///
+/// Writers reserve the space of a listing with an atomic add and write it
+/// at its offset, so workers never wait for each other. Each listing has
+/// its own index slot; the index is written by Close.
+class ListingArchive
+{
+public:
+    struct Entry
+    {
+        std::string name;
+        uint64_t offset;
+        uint64_t length;
+        uint32_t crc;
+    };
+
+    ListingArchive();
+    ~ListingArchive();
+
+    // Writing
+    bool Create(const std::string &filename, size_t count);
+    bool Write(size_t slot, const std::string &name, const std::string &data);
+    bool Close();
+
+    // Reading
+    bool Open(const std::string &filename);
+    size_t size() const { return m_entries.size(); };
+    const Entry &at(size_t i) const { return m_entries.at(i); };
+    const Entry *Find(const std::string &name) const;
+    bool Read(const Entry &entry, std::string &data) const;
+
+    static constexpr uint16_t FormatVersion = 1;
+    static constexpr uint32_t HeaderSize = 16;
+    static constexpr uint32_t TrailerSize = 24;
+
+private:
+    bool WriteAt(uint64_t offset, const void *pData, size_t size);
+    bool ReadAt(uint64_t offset, void *pData, size_t size) const;
+
+private:
+    std::string m_filename;
+    FILE *m_pFile;
+    std::atomic<uint64_t> m_end;
+    std::vector<Entry> m_entries;
+    std::vector<uint8_t> m_written;  // Not vector<bool>: slots are set concurrently
+    // Positioned writes are atomic on POSIX, others seek under a lock
+    mutable std::mutex m_fileMutex;
+};
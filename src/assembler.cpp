@@ -0,0 +1,478 @@
+/* npd project: assembler.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// NpAssembler class implementation
+
+#include <cstdlib>  // strtoul
+#include <sstream>
+
+#include "assembler.h"
+
+NpAssembler::NpAssembler(bool hexMode)
+: m_hex(hexMode), m_origin(0)
+{
+    Decoder::GetInstructionForms(m_forms);
+    BuildHashTable();
+}
+
+NpAssembler::~NpAssembler()
+{
+}
+
+/// @brief Assemble a source text into a binary
+/// @return false on errors, see Errors()
+bool NpAssembler::Assemble(std::istream &source, std::vector<uint8_t> &binary)
+{
+    m_statements.clear();
+    m_labels.clear();
+    m_errors.clear();
+    m_origin = 0;
+    binary.clear();
+
+    // First pass: label addresses
+    if (!ParseSource(source))
+    {
+        return false;
+    }
+
+    // Second pass: encode instructions
+    for (size_t i = 0; i < m_statements.size(); i++)
+    {
+        Encode(m_statements[i], binary);
+    }
+    return m_errors.empty();
+}
+
+/// @brief Split source lines in labels and statements
+bool NpAssembler::ParseSource(std::istream &source)
+{
+    std::string line;
+    size_t lineNumber = 0;
+    uint16_t address = 0;
+
+    while (std::getline(source, line))
+    {
+        lineNumber++;
+        if (!line.empty() && (line[line.size()-1] == '\r'))
+        {
+            line.erase(line.size()-1);
+        }
+
+        size_t first = line.find_first_not_of(" \t");
+        if (first == std::string::npos)
+        {
+            continue;
+        }
+
+        // Comment line. The header sets the numeric mode
+        if ((line[first] == ';') || (line[first] == '*'))
+        {
+            if (m_statements.empty())
+            {
+                if (line.find("Mode: Hexadecimal") != std::string::npos)
+                {
+                    m_hex = true;
+                }
+                else if (line.find("Mode: Octal") != std::string::npos)
+                {
+                    m_hex = false;
+                }
+            }
+            continue;
+        }
+
+        // Remove trailing comment. ASC strings may include ';' and '*'
+        bool quoted = false;
+        for (size_t i = first; i < line.size(); i++)
+        {
+            if (line[i] == '"')
+            {
+                quoted = !quoted;
+            }
+            else if (!quoted && ((line[i] == ';') || (line[i] == '*')))
+            {
+                line.erase(i);
+                break;
+            }
+        }
+
+        // Label at column 0
+        if (first == 0)
+        {
+            size_t end = line.find_first_of(" \t");
+            std::string label = line.substr(0, end);
+            if (m_labels.count(label) != 0)
+            {
+                Error(lineNumber, "Duplicate label '" + label + "'");
+            }
+            m_labels[label] = address;
+            first = line.find_first_not_of(" \t", label.size());
+            if (first == std::string::npos)
+            {
+                continue;
+            }
+        }
+
+        // Instruction: MNEMONIC [OPERAND]
+        size_t end = line.find_first_of(" \t", first);
+        std::string mnemonic = line.substr(first, end - first);
+        for (size_t i = 0; i < mnemonic.size(); i++)
+        {
+            mnemonic[i] = (char)toupper(mnemonic[i]);
+        }
+        if (mnemonic == "END")
+        {
+            break;
+        }
+        if (mnemonic == "ORG")
+        {
+            ParseOrigin(lineNumber, line.substr(end == std::string::npos ? line.size() : end), address);
+            continue;
+        }
+
+        Statement statement;
+        statement.line = lineNumber;
+        statement.address = address;
+        statement.pForm = FindMnemonic(mnemonic);
+        if (end != std::string::npos)
+        {
+            size_t start = line.find_first_not_of(" \t", end);
+            size_t last = line.find_last_not_of(" \t");
+            if (start != std::string::npos)
+            {
+                statement.operand = line.substr(start, last - start + 1);
+            }
+        }
+
+        // Data directives
+        if ((mnemonic == "DB") || (mnemonic == "DW") || (mnemonic == "ASC"))
+        {
+            if (ParseData(mnemonic, statement))
+            {
+                m_statements.push_back(statement);
+                address += (uint16_t)statement.data.size();
+            }
+            continue;
+        }
+        if (statement.pForm == NULL)
+        {
+            Error(lineNumber, "Unknown mnemonic '" + mnemonic + "'");
+            continue;
+        }
+
+        m_statements.push_back(statement);
+        switch (statement.pForm->operand)
+        {
+            case InstructionForm::ByteOperand:
+            case InstructionForm::Address:
+            case InstructionForm::Bits4Byte:
+                address += 2;
+                break;
+            default:
+                address += 1;
+                break;
+        }
+    }
+    return m_errors.empty();
+}
+
+/// @brief Set the address of the next statement. The binary starts at the
+/// first ORG before any statement; later ones may only skip addresses,
+/// filled with FF
+void NpAssembler::ParseOrigin(size_t lineNumber, std::string operand, uint16_t &address)
+{
+    operand.erase(0, operand.find_first_not_of(" \t"));
+    operand.erase(operand.find_last_not_of(" \t") + 1);
+    unsigned long value;
+    if (!ParseNumber(operand, true, 0xFFFF, value))
+    {
+        Error(lineNumber, "Invalid address '" + operand + "'");
+        return;
+    }
+    if (m_statements.empty())
+    {
+        m_origin = (uint16_t)value;
+    }
+    else if (value < address)
+    {
+        Error(lineNumber, "ORG before the current address");
+        return;
+    }
+    else if (value > address)
+    {
+        Statement fill;
+        fill.line = lineNumber;
+        fill.address = address;
+        fill.pForm = NULL;
+        fill.data.assign(value - address, 0xFF);
+        m_statements.push_back(fill);
+    }
+    address = (uint16_t)value;
+}
+
+/// @brief Parse the operands of DB, DW, and ASC into the statement data
+/// @return false on errors
+bool NpAssembler::ParseData(const std::string &mnemonic, Statement &statement)
+{
+    if (mnemonic == "ASC")
+    {
+        const std::string &operand = statement.operand;
+        if ((operand.size() < 2) || (operand[0] != '"') || (operand[operand.size()-1] != '"'))
+        {
+            Error(statement.line, "Invalid string " + operand);
+            return false;
+        }
+        statement.data.assign(operand.begin() + 1, operand.end() - 1);
+        return true;
+    }
+
+    // Comma separated numbers. Words are written high byte first
+    std::string item;
+    std::istringstream items(statement.operand);
+    while (std::getline(items, item, ','))
+    {
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        unsigned long value;
+        if (!ParseNumber(item, true, (mnemonic == "DB") ? 0xFF : 0xFFFF, value))
+        {
+            Error(statement.line, "Invalid data '" + item + "'");
+            return false;
+        }
+        if (mnemonic == "DW")
+        {
+            statement.data.push_back((uint8_t)(value >> 8));
+        }
+        statement.data.push_back((uint8_t)value);
+    }
+    if (statement.data.empty())
+    {
+        Error(statement.line, "Missing data operand");
+        return false;
+    }
+    return true;
+}
+
+/// @brief Encode a statement at the end of the binary
+void NpAssembler::Encode(const Statement &statement, std::vector<uint8_t> &binary)
+{
+    if (statement.pForm == NULL)
+    {
+        binary.insert(binary.end(), statement.data.begin(), statement.data.end());
+        return;
+    }
+
+    const InstructionForm &form = *statement.pForm;
+    unsigned long value = 0;
+    unsigned long parameter = 0;
+    std::string operand = statement.operand;
+    std::string data;
+
+    // Two operands: 'R0,017'
+    if (form.operand == InstructionForm::Bits4Byte)
+    {
+        size_t comma = operand.find(',');
+        if (comma == std::string::npos)
+        {
+            Error(statement.line, "Missing data operand");
+            return;
+        }
+        data = operand.substr(comma + 1);
+        operand.erase(comma);
+        data.erase(0, data.find_first_not_of(" \t"));
+        operand.erase(operand.find_last_not_of(" \t") + 1);
+    }
+
+    switch (form.operand)
+    {
+        case InstructionForm::NoOperand:
+            if (!operand.empty())
+            {
+                Error(statement.line, "Unexpected operand '" + operand + "'");
+                return;
+            }
+            binary.push_back(form.opcode);
+            break;
+
+        case InstructionForm::ByteOperand:
+            if (!ParseNumber(operand, true, 0xFF, value))
+            {
+                Error(statement.line, "Invalid data '" + operand + "'");
+                return;
+            }
+            binary.push_back(form.opcode);
+            binary.push_back((uint8_t)value);
+            break;
+
+        case InstructionForm::Address:
+            if (!ParseAddress(statement, operand, value))
+            {
+                return;
+            }
+            // 11-bit operand: the target is in the 2K bank of the instruction
+            if ((value & ~0x7FFul) != (statement.address & ~0x7FFul))
+            {
+                Error(statement.line, "Target '" + operand + "' out of the 2K bank");
+                return;
+            }
+            binary.push_back((uint8_t)(form.opcode | ((value >> 8) & 0x07)));
+            binary.push_back((uint8_t)(value & 0xFF));
+            break;
+
+        case InstructionForm::Bits3:
+            if (!ParseOperand(statement, operand, 7, value))
+            {
+                return;
+            }
+            binary.push_back((uint8_t)(form.opcode | value));
+            break;
+
+        case InstructionForm::Bits4:
+            if (!ParseOperand(statement, operand, 15, value))
+            {
+                return;
+            }
+            binary.push_back((uint8_t)(form.opcode | value));
+            break;
+
+        case InstructionForm::Bits4Byte:
+            if (!ParseOperand(statement, operand, 15, value))
+            {
+                return;
+            }
+            if (!ParseNumber(data, true, 0xFF, parameter))
+            {
+                Error(statement.line, "Invalid data '" + data + "'");
+                return;
+            }
+            binary.push_back((uint8_t)(form.opcode | value));
+            binary.push_back((uint8_t)parameter);
+            break;
+    }
+}
+
+/// @brief Find a seed that hashes all mnemonics without collisions
+void NpAssembler::BuildHashTable()
+{
+    m_hashBits = 1;
+    while ((1u << m_hashBits) < 2 * m_forms.size())
+    {
+        m_hashBits++;
+    }
+
+    for (m_hashSeed = 1; ; m_hashSeed++)
+    {
+        m_hashTable.assign((size_t)1 << m_hashBits, -1);
+        bool collision = false;
+        for (size_t i = 0; (i < m_forms.size()) && !collision; i++)
+        {
+            int &slot = m_hashTable[Hash(m_forms[i].mnemonic, m_hashSeed)];
+            collision = (slot >= 0);
+            slot = (int)i;
+        }
+        if (!collision)
+        {
+            return;
+        }
+        // Grow the table if no seed fits
+        if ((m_hashSeed % 4096) == 0)
+        {
+            m_hashBits++;
+        }
+    }
+}
+
+uint32_t NpAssembler::Hash(const std::string &mnemonic, uint32_t seed) const
+{
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < mnemonic.size(); i++)
+    {
+        hash = (hash ^ (uint8_t)mnemonic[i]) * 16777619u;
+    }
+    return (hash * 2654435761u) >> (32 - m_hashBits);
+}
+
+/// @brief Instruction form of a mnemonic
+/// @return NULL if unknown
+const InstructionForm *NpAssembler::FindMnemonic(const std::string &mnemonic) const
+{
+    int i = m_hashTable[Hash(mnemonic, m_hashSeed)];
+    if ((i < 0) || (m_forms[i].mnemonic != mnemonic))
+    {
+        return NULL;
+    }
+    return &m_forms[i];
+}
+
+/// @brief Parse a number in the current numeric mode ('radix') or in decimal
+bool NpAssembler::ParseNumber(const std::string &text, bool radix, unsigned long maximum, unsigned long &value) const
+{
+    if (text.empty())
+    {
+        return false;
+    }
+    int base = radix ? (m_hex ? 16 : 8) : 10;
+    char *end;
+    value = strtoul(text.c_str(), &end, base);
+    return ((*end == '\0') && (value <= maximum));
+}
+
+/// @brief Parse a prefixed decimal operand: 'R5', 'DS3', 'DC2', or '7'
+bool NpAssembler::ParseOperand(const Statement &statement, const std::string &text, unsigned long maximum, unsigned long &value)
+{
+    const std::string &prefix = statement.pForm->prefix;
+    std::string upper = text;
+    for (size_t i = 0; i < upper.size(); i++)
+    {
+        upper[i] = (char)toupper(upper[i]);
+    }
+
+    if ((upper.compare(0, prefix.size(), prefix) != 0) ||
+        !ParseNumber(upper.substr(prefix.size()), false, maximum, value))
+    {
+        Error(statement.line, "Invalid operand '" + text + "'");
+        return false;
+    }
+    return true;
+}
+
+/// @brief Parse a JMP or JSB target: a label, or 'L_' and an address
+bool NpAssembler::ParseAddress(const Statement &statement, const std::string &text, unsigned long &value)
+{
+    std::map<std::string, uint16_t>::const_iterator it = m_labels.find(text);
+    if (it != m_labels.end())
+    {
+        value = it->second;
+        return true;
+    }
+
+    // Labels out of the listing keep their address in the name
+    if ((text.compare(0, 2, "L_") == 0) && ParseNumber(text.substr(2), true, 0xFFFF, value))
+    {
+        return true;
+    }
+
+    Error(statement.line, "Undefined label '" + text + "'");
+    return false;
+}
+
+void NpAssembler::Error(size_t line, const std::string &message)
+{
+    m_errors.push_back("line " + std::to_string(line) + ": " + message);
+}
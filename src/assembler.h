@@ -0,0 +1,84 @@
+/* npd project: assembler.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <istream>
+#include <cstdint>
+
+#include "decoder.h"
+
+/// @brief Nanoprocessor assembler for the 'npd -a' .asm syntax
+/// Labels start at column 0, instructions are indented, and ';' or '*'
+/// start a comment. Numbers are octal or hexadecimal as set by the
+/// constructor or by the 'Mode:' header comment. Register, device, control
+/// line, and bit operands are decimal. Data directives: 'DB' bytes, 'DW'
+/// words (high byte first), and 'ASC "text"'. 'ORG' sets the address of the
+/// next statement, i.e. the window start of 'npd -a --start'.
+class NpAssembler
+{
+public:
+    NpAssembler(bool hexMode);
+    ~NpAssembler();
+
+    bool Assemble(std::istream &source, std::vector<uint8_t> &binary);
+    uint16_t Origin() const { return m_origin; };
+    const std::vector<std::string> &Errors() const { return m_errors; };
+
+private:
+    struct Statement
+    {
+        size_t line;
+        uint16_t address;
+        const InstructionForm *pForm;  // NULL for data directives
+        std::string operand;
+        std::vector<uint8_t> data;
+    };
+
+    bool ParseSource(std::istream &source);
+    void ParseOrigin(size_t lineNumber, std::string operand, uint16_t &address);
+    bool ParseData(const std::string &mnemonic, Statement &statement);
+    void Encode(const Statement &statement, std::vector<uint8_t> &binary);
+
+    void BuildHashTable();
+    const InstructionForm *FindMnemonic(const std::string &mnemonic) const;
+    uint32_t Hash(const std::string &mnemonic, uint32_t seed) const;
+
+    bool ParseNumber(const std::string &text, bool radix, unsigned long maximum, unsigned long &value) const;
+    bool ParseOperand(const Statement &statement, const std::string &text, unsigned long maximum, unsigned long &value);
+    bool ParseAddress(const Statement &statement, const std::string &text, unsigned long &value);
+    void Error(size_t line, const std::string &message);
+
+private:
+    bool m_hex;
+    uint16_t m_origin;  // address of the first binary byte
+    std::vector<InstructionForm> m_forms;
+
+    // Perfect hash of the mnemonics: collision free table of form indexes
+    std::vector<int> m_hashTable;
+    uint32_t m_hashSeed;
+    int m_hashBits;
+
+    std::vector<Statement> m_statements;
+    std::map<std::string, uint16_t> m_labels;
+    std::vector<std::string> m_errors;
+};
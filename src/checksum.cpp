@@ -0,0 +1,504 @@
+/* npd project: checksum.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// ChecksumVerifier class implementation
+
+#include <iostream>
+#include <cstdio>  // snprintf
+#include <cstdlib>  // strtoul
+#include <cstring>  // memcmp
+#include <algorithm>  // min
+
+#include "checksum.h"
+
+// CRC-16/CCITT (0x1021, not reflected) and CRC-32 (0xEDB88320, reflected).
+// Table k holds the CRC of a byte followed by k zero bytes
+namespace
+{
+struct CrcTables
+{
+    uint16_t crc16[8][256];
+    uint32_t crc32[8][256];
+
+    CrcTables()
+    {
+        for (unsigned v = 0; v < 256; v++)
+        {
+            uint16_t r16 = (uint16_t)(v << 8);
+            uint32_t r32 = v;
+            for (int b = 0; b < 8; b++)
+            {
+                r16 = (r16 & 0x8000) ? (uint16_t)((r16 << 1) ^ 0x1021) : (uint16_t)(r16 << 1);
+                r32 = (r32 & 1) ? ((r32 >> 1) ^ 0xEDB88320u) : (r32 >> 1);
+            }
+            crc16[0][v] = r16;
+            crc32[0][v] = r32;
+        }
+        for (int k = 1; k < 8; k++)
+        {
+            for (unsigned v = 0; v < 256; v++)
+            {
+                uint16_t r16 = crc16[k - 1][v];
+                crc16[k][v] = (uint16_t)((r16 << 8) ^ crc16[0][r16 >> 8]);
+                uint32_t r32 = crc32[k - 1][v];
+                crc32[k][v] = (r32 >> 8) ^ crc32[0][r32 & 0xFF];
+            }
+        }
+    }
+};
+
+const CrcTables &Tables()
+{
+    static const CrcTables tables;
+    return tables;
+}
+}
+
+ChecksumVerifier::ChecksumVerifier()
+{
+}
+
+ChecksumVerifier::~ChecksumVerifier()
+{
+}
+
+/// @brief Parse an address: decimal, 0x hexadecimal, or 0 octal
+bool ChecksumVerifier::ParseAddress(const std::string &text, size_t &address)
+{
+    char *end;
+    unsigned long value = strtoul(text.c_str(), &end, 0);
+    if (text.empty() || (*end != '\0') || (value > 0xFFFF))
+    {
+        return false;
+    }
+    address = value;
+    return true;
+}
+
+/// @brief Add a checksum specification: 'ALGORITHM[@LOCATION][:START-END]'
+/// @return false if invalid
+bool ChecksumVerifier::AddSpec(const std::string &text)
+{
+    Spec spec;
+    spec.convention = Plain;
+    spec.lowByteFirst = false;
+    spec.stored = false;
+    spec.location = 0;
+    spec.hasRange = false;
+    spec.start = 0;
+    spec.end = 0;
+
+    std::string name = text;
+    std::string range;
+    std::string location;
+    size_t colon = name.find(':');
+    if (colon != std::string::npos)
+    {
+        range = name.substr(colon + 1);
+        name.erase(colon);
+    }
+    size_t at = name.find('@');
+    if (at != std::string::npos)
+    {
+        location = name.substr(at + 1);
+        name.erase(at);
+        spec.stored = true;
+    }
+    size_t slash = name.find('/');
+    if (slash != std::string::npos)
+    {
+        spec.flags = name.substr(slash + 1);
+        name.erase(slash);
+    }
+
+    bool valid = false;
+    for (int i = Sum8; i <= Crc32; i++)
+    {
+        if (name == AlgorithmName((Algorithm)i))
+        {
+            spec.algorithm = (Algorithm)i;
+            valid = true;
+        }
+    }
+    for (size_t i = 0; valid && (i < spec.flags.size()); i++)
+    {
+        switch (spec.flags[i])
+        {
+            case 'c': spec.convention = Complement; break;
+            case 'n': spec.convention = Negate; break;
+            case 'l': spec.lowByteFirst = true; break;
+            case 'b': spec.lowByteFirst = false; break;
+            default: valid = false; break;
+        }
+    }
+    if (valid && spec.stored)
+    {
+        valid = ParseAddress(location, spec.location);
+    }
+    if (valid && (colon != std::string::npos))
+    {
+        spec.hasRange = true;
+        size_t dash = range.find('-');
+        valid = (dash != std::string::npos) &&
+                ParseAddress(range.substr(0, dash), spec.start) &&
+                ParseAddress(range.substr(dash + 1), spec.end) &&
+                (spec.end >= spec.start);
+    }
+    if (!valid)
+    {
+        std::cerr << "Invalid checksum '" << text << "'\n";
+        return false;
+    }
+    m_specs.push_back(spec);
+    return true;
+}
+
+const char *ChecksumVerifier::AlgorithmName(Algorithm algorithm)
+{
+    switch (algorithm)
+    {
+        case Sum16:
+            return "sum16";
+        case Xor8:
+            return "xor8";
+        case Crc16:
+            return "crc16";
+        case Crc32:
+            return "crc32";
+        default:
+            return "sum8";
+    }
+}
+
+/// @brief Stored checksum size in bytes
+size_t ChecksumVerifier::Width(Algorithm algorithm)
+{
+    switch (algorithm)
+    {
+        case Sum16:
+        case Crc16:
+            return 2;
+        case Crc32:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+/// @brief Byte sum. 32-bit lanes: no overflow below 16MB
+uint32_t ChecksumVerifier::SumBytes(const uint8_t *pData, size_t size)
+{
+    uint32_t total = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        total += pData[i];
+    }
+    return total;
+}
+
+uint8_t ChecksumVerifier::XorBytes(const uint8_t *pData, size_t size)
+{
+    uint8_t total = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        total ^= pData[i];
+    }
+    return total;
+}
+
+/// @brief CRC-16/CCITT, 8 bytes per step
+uint16_t ChecksumVerifier::UpdateCrc16(uint16_t crc, const uint8_t *pData, size_t size)
+{
+    const CrcTables &t = Tables();
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        const uint8_t *p = pData + i;
+        crc = (uint16_t)(t.crc16[7][p[0] ^ (crc >> 8)] ^ t.crc16[6][p[1] ^ (crc & 0xFF)] ^
+                         t.crc16[5][p[2]] ^ t.crc16[4][p[3]] ^ t.crc16[3][p[4]] ^
+                         t.crc16[2][p[5]] ^ t.crc16[1][p[6]] ^ t.crc16[0][p[7]]);
+    }
+    for (; i < size; i++)
+    {
+        crc = (uint16_t)((crc << 8) ^ t.crc16[0][(crc >> 8) ^ pData[i]]);
+    }
+    return crc;
+}
+
+/// @brief CRC-32 (IEEE), 8 bytes per step
+uint32_t ChecksumVerifier::UpdateCrc32(uint32_t crc, const uint8_t *pData, size_t size)
+{
+    const CrcTables &t = Tables();
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        const uint8_t *p = pData + i;
+        uint32_t x = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+        crc = t.crc32[7][x & 0xFF] ^ t.crc32[6][(x >> 8) & 0xFF] ^
+              t.crc32[5][(x >> 16) & 0xFF] ^ t.crc32[4][x >> 24] ^
+              t.crc32[3][p[4]] ^ t.crc32[2][p[5]] ^ t.crc32[1][p[6]] ^ t.crc32[0][p[7]];
+    }
+    for (; i < size; i++)
+    {
+        crc = (crc >> 8) ^ t.crc32[0][(crc ^ pData[i]) & 0xFF];
+    }
+    return crc;
+}
+
+uint32_t ChecksumVerifier::Compute(Algorithm algorithm, const uint8_t *pImage, const Segments &segments) const
+{
+    uint32_t value = 0;
+    switch (algorithm)
+    {
+        case Sum8:
+        case Sum16:
+            for (size_t s = 0; s < segments.count; s++)
+            {
+                value += SumBytes(pImage + segments.start[s], segments.size[s]);
+            }
+            return value & ((algorithm == Sum8) ? 0xFF : 0xFFFF);
+        case Xor8:
+            for (size_t s = 0; s < segments.count; s++)
+            {
+                value ^= XorBytes(pImage + segments.start[s], segments.size[s]);
+            }
+            return value;
+        case Crc16:
+            value = 0xFFFF;
+            for (size_t s = 0; s < segments.count; s++)
+            {
+                value = UpdateCrc16((uint16_t)value, pImage + segments.start[s], segments.size[s]);
+            }
+            return value;
+        case Crc32:
+            value = 0xFFFFFFFF;
+            for (size_t s = 0; s < segments.count; s++)
+            {
+                value = UpdateCrc32(value, pImage + segments.start[s], segments.size[s]);
+            }
+            return value ^ 0xFFFFFFFF;
+    }
+    return value;
+}
+
+/// @brief Stored form of a computed checksum of 'mask' bits
+uint32_t ChecksumVerifier::Convert(Convention convention, uint32_t value, uint32_t mask)
+{
+    switch (convention)
+    {
+        case Complement:
+            return ~value & mask;
+        case Negate:
+            return (0u - value) & mask;
+        default:
+            return value;
+    }
+}
+
+/// @brief Find the bit whose flip explains a CRC mismatch
+/// CRCs are linear: a flipped bit changes the CRC by the CRC of the error
+/// alone. Walks the bytes from the last one, shifting the 8 candidate errors
+/// through one zero byte per step
+/// @return false if no single bit flip explains 'syndrome'
+bool ChecksumVerifier::LocateBitError(Algorithm algorithm, const Segments &segments,
+                                      uint32_t syndrome, size_t &offset, int &bit) const
+{
+    if ((algorithm != Crc16) && (algorithm != Crc32))
+    {
+        return false;
+    }
+    const CrcTables &t = Tables();
+    uint32_t errors[8];
+    for (int b = 0; b < 8; b++)
+    {
+        errors[b] = (algorithm == Crc16) ? t.crc16[0][1 << b] : t.crc32[0][1 << b];
+    }
+
+    for (size_t s = segments.count; s-- > 0; )
+    {
+        for (size_t i = segments.size[s]; i-- > 0; )
+        {
+            for (int b = 0; b < 8; b++)
+            {
+                if (errors[b] == syndrome)
+                {
+                    offset = segments.start[s] + i;
+                    bit = b;
+                    return true;
+                }
+                uint32_t r = errors[b];
+                errors[b] = (algorithm == Crc16) ? (uint16_t)((r << 8) ^ t.crc16[0][(r >> 8) & 0xFF])
+                                                 : (r >> 8) ^ t.crc32[0][r & 0xFF];
+            }
+        }
+    }
+    return false;
+}
+
+/// @brief Verify the checksums of an image at 'origin'
+/// The report lines are for the listing header
+/// @return false if a stored checksum does not match
+bool ChecksumVerifier::Verify(const std::vector<uint8_t> &image, size_t origin, const Decoder &decoder,
+                              std::vector<std::string> &report) const
+{
+    bool verified = true;
+    size_t imageEnd = origin + image.size();
+    for (size_t i = 0; i < m_specs.size(); i++)
+    {
+        const Spec &spec = m_specs[i];
+        size_t width = Width(spec.algorithm);
+        size_t start = spec.hasRange ? spec.start : origin;
+        size_t end = spec.hasRange ? spec.end + 1 : imageEnd;
+        uint32_t mask = (width == 4) ? 0xFFFFFFFF : ((1u << (8 * width)) - 1);
+
+        std::string line("Checksum ");
+        line.append(AlgorithmName(spec.algorithm));
+        if (!spec.flags.empty())
+        {
+            line.append("/" + spec.flags);
+        }
+        line.push_back(' ');
+        if ((start < origin) || (end > imageEnd) || (spec.stored &&
+            ((spec.location < origin) || (spec.location + width > imageEnd))))
+        {
+            line.append("out of the image");
+            report.push_back(line);
+            verified = false;
+            continue;
+        }
+        decoder.AppendAddressString((uint16_t)start, line);
+        line.push_back('-');
+        decoder.AppendAddressString((uint16_t)(end - 1), line);
+        line.append(": ");
+
+        // Leave the stored checksum out
+        Segments segments;
+        segments.count = 0;
+        size_t storedStart = spec.stored ? std::max(spec.location, start) : end;
+        size_t storedEnd = spec.stored ? std::max(std::min(spec.location + width, end), storedStart) : end;
+        storedStart = std::min(storedStart, end);
+        if (storedStart > start)
+        {
+            segments.start[segments.count] = start - origin;
+            segments.size[segments.count++] = storedStart - start;
+        }
+        if (end > storedEnd)
+        {
+            segments.start[segments.count] = storedEnd - origin;
+            segments.size[segments.count++] = end - storedEnd;
+        }
+
+        // Listed as stored. Hints work on the computed value
+        uint32_t value = Compute(spec.algorithm, image.data(), segments);
+        char text[16];
+        snprintf(text, sizeof(text), "0x%0*X", (int)(2 * width), Convert(spec.convention, value, mask));
+        line.append(text);
+        if (!spec.stored)
+        {
+            report.push_back(line);
+            continue;
+        }
+
+        uint32_t stored = 0;
+        for (size_t k = 0; k < width; k++)
+        {
+            size_t byte = spec.lowByteFirst ? (width - 1 - k) : k;
+            stored = (stored << 8) | image[spec.location - origin + byte];
+        }
+        snprintf(text, sizeof(text), "0x%0*X", (int)(2 * width), stored);
+        // Complement and negation are their own inverses
+        stored = Convert(spec.convention, stored, mask);
+        line.append(", stored at ");
+        decoder.AppendAddressString((uint16_t)spec.location, line);
+        line.append(": ");
+        line.append(text);
+        line.append((value == stored) ? "  OK" : "  MISMATCH");
+        report.push_back(line);
+        if (value == stored)
+        {
+            continue;
+        }
+        verified = false;
+
+        // Bit-rot hints
+        size_t offset;
+        int bit;
+        if (LocateBitError(spec.algorithm, segments, value ^ stored, offset, bit))
+        {
+            line = "Bit-rot hint: bit " + std::to_string(bit) + " flipped at ";
+            decoder.AppendAddressString((uint16_t)(origin + offset), line);
+            report.push_back(line);
+        }
+        else if ((spec.algorithm != Crc16) && (spec.algorithm != Crc32))
+        {
+            // A flipped bit b changes a XOR by 2^b, and a sum by +-2^b
+            uint32_t difference = (value - stored) & mask;
+            for (int b = 0; b < 8; b++)
+            {
+                uint32_t flip = 1u << b;
+                if ((spec.algorithm == Xor8) ? ((value ^ stored) == flip)
+                                             : ((difference == flip) || (difference == ((0u - flip) & mask))))
+                {
+                    report.push_back("Bit-rot hint: bit " + std::to_string(b) + " flipped in one byte");
+                }
+            }
+        }
+    }
+    StuckBitHints(image, origin, decoder, report);
+    return verified;
+}
+
+/// @brief Data bits equal in every byte, and an upper half equal to the lower half
+void ChecksumVerifier::StuckBitHints(const std::vector<uint8_t> &image, size_t origin, const Decoder &decoder,
+                                     std::vector<std::string> &report) const
+{
+    // Small images may not use every bit
+    static const size_t MinSize = 256;
+    size_t size = image.size();
+    if (size < MinSize)
+    {
+        return;
+    }
+
+    uint8_t ones = 0;
+    uint8_t zeros = 0xFF;
+    for (size_t i = 0; i < size; i++)
+    {
+        ones |= image[i];
+        zeros &= image[i];
+    }
+    for (int b = 7; b >= 0; b--)
+    {
+        if (!(ones & (1 << b)) || (zeros & (1 << b)))
+        {
+            report.push_back("Bit-rot hint: data bit " + std::to_string(b) + " is " +
+                             ((zeros & (1 << b)) ? "1" : "0") + " in every byte");
+        }
+    }
+
+    if (((size & (size - 1)) == 0) && (memcmp(image.data(), image.data() + (size / 2), size / 2) == 0))
+    {
+        std::string line("Bit-rot hint: ");
+        decoder.AppendAddressString((uint16_t)(origin + (size / 2)), line);
+        line.append("-");
+        decoder.AppendAddressString((uint16_t)(origin + size - 1), line);
+        line.append(" repeats the lower half, an address line may be stuck");
+        report.push_back(line);
+    }
+}
@@ -0,0 +1,115 @@
+/* npd project: checksum.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "decoder.h"
+
+/// @brief ROM checksum verification
+/// Checksum specification: 'ALGORITHM[/FLAGS][@LOCATION][:START-END]'
+///   ALGORITHM  sum8, sum16 (byte sums), xor8, crc16 (CCITT, init FFFF),
+///              or crc32 (IEEE)
+///   FLAGS      stored value: c complement, n negated (the sum of the range
+///              and the checksum is 0), l low byte first, b high byte first
+///   LOCATION   address of the stored checksum, high byte first by default.
+///              Its bytes are left out of the computation
+///   START-END  address range, END is the last address. The default is the image
+/// Addresses are decimal, 0x hexadecimal, or 0 octal. i.e. 'sum8/n@0x7FF'
+///
+/// Sums are plain loops over wide accumulators and the CRCs use slicing by
+/// 8 tables, so all kernels run near memory speed without intrinsics.
+/// A mismatch gets bit-rot hints: the bit a single flip would explain and,
+/// for CRCs, its address. Stuck data bits and a mirrored upper half
+/// (a stuck address line) are reported for every verified image.
+class ChecksumVerifier
+{
+public:
+    enum Algorithm
+    {
+        Sum8,
+        Sum16,
+        Xor8,
+        Crc16,
+        Crc32
+    };
+
+    ChecksumVerifier();
+    ~ChecksumVerifier();
+
+    bool AddSpec(const std::string &text);
+    bool empty() const { return m_specs.empty(); };
+
+    bool Verify(const std::vector<uint8_t> &image, size_t origin, const Decoder &decoder,
+                std::vector<std::string> &report) const;
+
+    // Kernels. CRCs continue from 'crc'
+    static uint32_t SumBytes(const uint8_t *pData, size_t size);
+    static uint8_t XorBytes(const uint8_t *pData, size_t size);
+    static uint16_t UpdateCrc16(uint16_t crc, const uint8_t *pData, size_t size);
+    static uint32_t UpdateCrc32(uint32_t crc, const uint8_t *pData, size_t size);
+
+    static const char *AlgorithmName(Algorithm algorithm);
+    static size_t Width(Algorithm algorithm);
+
+private:
+    // Stored value of a checksum
+    enum Convention
+    {
+        Plain,
+        Complement,
+        Negate
+    };
+
+    struct Spec
+    {
+        Algorithm algorithm;
+        std::string flags;
+        Convention convention;
+        bool lowByteFirst;
+        bool stored;
+        size_t location;
+        bool hasRange;
+        size_t start;
+        size_t end;  // last address
+    };
+
+    // Image bytes of a checksum: up to two segments around the stored value
+    struct Segments
+    {
+        size_t count;
+        size_t start[2];
+        size_t size[2];
+    };
+
+    static bool ParseAddress(const std::string &text, size_t &address);
+    static uint32_t Convert(Convention convention, uint32_t value, uint32_t mask);
+    uint32_t Compute(Algorithm algorithm, const uint8_t *pImage, const Segments &segments) const;
+    bool LocateBitError(Algorithm algorithm, const Segments &segments,
+                        uint32_t syndrome, size_t &offset, int &bit) const;
+    void StuckBitHints(const std::vector<uint8_t> &image, size_t origin, const Decoder &decoder,
+                       std::vector<std::string> &report) const;
+
+private:
+    std::vector<Spec> m_specs;
+};
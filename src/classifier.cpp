@@ -0,0 +1,295 @@
+/* npd project: classifier.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// CodeClassifier class implementation
+
+#include <cmath>  // log2
+#include <sstream>
+
+#include "classifier.h"
+
+CodeClassifier::CodeClassifier()
+{
+    std::string mnemonic;
+    std::string comment;
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        uint8_t x = (uint8_t)opcode;
+        m_decoder.TranslateOpCode(x, 0, mnemonic, comment);
+        m_flags[x] = 0;
+        m_flags[x] |= (mnemonic == "???") ? Unknown : 0;
+        m_flags[x] |= m_decoder.isTwoByteInstruction(x) ? TwoByte : 0;
+        m_flags[x] |= m_decoder.isDirectAddressing(x) ? Direct : 0;
+        m_flags[x] |= m_decoder.isSubroutineCall(x) ? Call : 0;
+        m_flags[x] |= m_decoder.isReturnOrJumpInstruction(x) ? Stop : 0;
+        m_flags[x] |= m_decoder.isSkipInstruction(x) ? Skip : 0;
+    }
+}
+
+CodeClassifier::~CodeClassifier()
+{
+}
+
+/// @brief Suggest data regions of an image starting at 'origin'
+void CodeClassifier::Classify(const std::vector<uint8_t> &image, size_t origin, RegionMap &suggestions) const
+{
+    size_t size = std::min(image.size(), (size_t)0x10000 - std::min(origin, (size_t)0x10000));
+    if (size < MinRegionSize)
+    {
+        return;
+    }
+    const uint8_t *pImage = image.data();
+
+    // Per byte signals
+    std::vector<uint8_t> unknown(size, 0);
+    std::vector<uint8_t> badJump(size, 0);
+    std::vector<uint8_t> reachable(size, 0);
+    std::vector<uint8_t> lowEntropy(size, 0);
+    Decode(pImage, size, origin, unknown, badJump);
+    Reach(pImage, size, origin, reachable);
+    LowEntropy(pImage, size, lowEntropy);
+
+    // Prefix sums: the count of a window is a difference
+    std::vector<uint32_t> sumUnknown(size + 1, 0);
+    std::vector<uint32_t> sumBadJump(size + 1, 0);
+    std::vector<uint32_t> sumReachable(size + 1, 0);
+    std::vector<uint32_t> sumLowEntropy(size + 1, 0);
+    std::vector<uint32_t> sumPrintable(size + 1, 0);
+    for (size_t i = 0; i < size; i++)
+    {
+        sumUnknown[i + 1] = sumUnknown[i] + unknown[i];
+        sumBadJump[i + 1] = sumBadJump[i] + badJump[i];
+        sumReachable[i + 1] = sumReachable[i] + reachable[i];
+        sumLowEntropy[i + 1] = sumLowEntropy[i] + lowEntropy[i];
+        sumPrintable[i + 1] = sumPrintable[i] + (((pImage[i] >= ' ') && (pImage[i] <= '~')) ? 1 : 0);
+    }
+
+    // Block scores over a window centered on each block
+    size_t blocks = (size + BlockSize - 1) / BlockSize;
+    std::vector<uint8_t> blockType(blocks, Region::Code);
+    for (size_t b = 0; b < blocks; b++)
+    {
+        size_t center = (b * BlockSize) + (BlockSize / 2);
+        size_t first = (center > WindowSize / 2) ? center - (WindowSize / 2) : 0;
+        size_t last = std::min(first + WindowSize, size);
+        size_t blockEnd = std::min((b + 1) * BlockSize, size);
+
+        uint32_t score = (2 * (sumUnknown[last] - sumUnknown[first])) +
+                         (sumBadJump[last] - sumBadJump[first]);
+        size_t blockSize = blockEnd - (b * BlockSize);
+        if ((sumLowEntropy[blockEnd] - sumLowEntropy[b * BlockSize]) * 2 > blockSize)
+        {
+            score += 3;
+        }
+        // Printable bytes also decode as register moves: text is never reached
+        bool text = (sumPrintable[last] - sumPrintable[first]) * 10 >= (last - first) * 9;
+        bool reached = (sumReachable[blockEnd] - sumReachable[b * BlockSize]) * 2 > blockSize;
+        if (reached)
+        {
+            blockType[b] = Region::Code;
+        }
+        else
+        {
+            blockType[b] = text ? Region::Ascii : ((score >= 3) ? Region::Bytes : Region::Code);
+        }
+    }
+
+    // Runs of data blocks of a type, trimmed to the reachable code
+    size_t b = 0;
+    while (b < blocks)
+    {
+        uint8_t type = blockType[b];
+        if (type == Region::Code)
+        {
+            b++;
+            continue;
+        }
+        size_t start = b * BlockSize;
+        while ((b < blocks) && (blockType[b] == type))
+        {
+            b++;
+        }
+        size_t end = std::min(b * BlockSize, size);
+        while ((start < end) && reachable[start])
+        {
+            start++;
+        }
+        while ((end > start) && reachable[end - 1])
+        {
+            end--;
+        }
+        if (end - start < MinRegionSize)
+        {
+            continue;
+        }
+
+        Region region;
+        region.start = origin + start;
+        region.end = origin + end - 1;
+        region.type = (Region::Type)type;
+        std::ostringstream comment;
+        comment << "classifier: " << (sumUnknown[end] - sumUnknown[start]) << " unknown opcodes, "
+                << (sumBadJump[end] - sumBadJump[start]) << " bad jumps";
+        region.comment = comment.str();
+        suggestions.Add(region);
+    }
+}
+
+/// @brief Data score of a whole image, the block score of Classify: 2 per
+/// unknown opcode and 1 per bad jump of the linear decode. Code scores low
+uint32_t CodeClassifier::Score(const std::vector<uint8_t> &image, size_t origin) const
+{
+    size_t size = std::min(image.size(), (size_t)0x10000 - std::min(origin, (size_t)0x10000));
+    std::vector<uint8_t> unknown(size, 0);
+    std::vector<uint8_t> badJump(size, 0);
+    Decode(image.data(), size, origin, unknown, badJump);
+    uint32_t score = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        score += (2 * unknown[i]) + badJump[i];
+    }
+    return score;
+}
+
+/// @brief Linear decode: unknown opcodes, and jumps to no instruction start
+void CodeClassifier::Decode(const uint8_t *pImage, size_t size, size_t origin,
+                            std::vector<uint8_t> &unknown, std::vector<uint8_t> &badJump) const
+{
+    std::vector<uint8_t> isStart(size, 0);
+    std::vector<size_t> jumps;
+    size_t i = 0;
+    while (i < size)
+    {
+        uint8_t opcode = pImage[i];
+        isStart[i] = 1;
+        unknown[i] = m_flags[opcode] & Unknown;
+        if ((m_flags[opcode] & Direct) && (i + 1 < size))
+        {
+            jumps.push_back(i);
+        }
+        i += InstructionSize(opcode);
+    }
+
+    for (size_t j = 0; j < jumps.size(); j++)
+    {
+        size_t at = jumps[j];
+        size_t target = m_decoder.BankedAddress((uint16_t)(origin + at), pImage[at], pImage[at + 1]);
+        if ((target < origin) || (target - origin >= size) || !isStart[target - origin])
+        {
+            badJump[at] = 1;
+        }
+    }
+}
+
+/// @brief Bytes of the instructions reachable from the start of each 2K bank
+void CodeClassifier::Reach(const uint8_t *pImage, size_t size, size_t origin, std::vector<uint8_t> &reachable) const
+{
+    std::vector<size_t> pending;
+    for (size_t bank = (origin + Decoder::BankSize - 1) & ~(size_t)(Decoder::BankSize - 1);
+         bank < origin + size; bank += Decoder::BankSize)
+    {
+        pending.push_back(bank - origin);
+    }
+    if (origin % Decoder::BankSize)
+    {
+        pending.push_back(0);
+    }
+
+    while (!pending.empty())
+    {
+        size_t i = pending.back();
+        pending.pop_back();
+
+        // Straight line code up to a jump or a return
+        while ((i < size) && !reachable[i])
+        {
+            uint8_t opcode = pImage[i];
+            size_t next = i + InstructionSize(opcode);
+            if ((next > size) || (m_flags[opcode] & Unknown))
+            {
+                break;
+            }
+            for (size_t k = i; k < next; k++)
+            {
+                reachable[k] = 1;
+            }
+
+            if (m_flags[opcode] & Direct)
+            {
+                size_t target = m_decoder.BankedAddress((uint16_t)(origin + i), opcode, pImage[i + 1]);
+                if ((target >= origin) && (target - origin < size))
+                {
+                    pending.push_back(target - origin);
+                }
+            }
+            if (m_flags[opcode] & Skip)
+            {
+                pending.push_back(next + 2);
+            }
+            if (m_flags[opcode] & Stop)
+            {
+                break;
+            }
+            i = next;
+        }
+    }
+}
+
+/// @brief Bytes in windows of low entropy: fill, padding, constant tables
+void CodeClassifier::LowEntropy(const uint8_t *pImage, size_t size, std::vector<uint8_t> &lowEntropy) const
+{
+    // Entropy in bits: log2(W) - sum(c * log2(c)) / W. Low below 2 bits
+    static const double Threshold = 2.0;
+    std::vector<double> cLog2c(WindowSize + 1, 0.0);
+    for (size_t c = 1; c <= WindowSize; c++)
+    {
+        cLog2c[c] = c * log2((double)c);
+    }
+    double limit = (log2((double)WindowSize) - Threshold) * WindowSize;
+
+    size_t window = std::min(size, WindowSize);
+    uint32_t counts[256] = {0};
+    double sum = 0.0;  // sum(c * log2(c))
+    for (size_t i = 0; i < window; i++)
+    {
+        uint8_t x = pImage[i];
+        sum += cLog2c[counts[x] + 1] - cLog2c[counts[x]];
+        counts[x]++;
+    }
+
+    // Each window marks its first byte
+    for (size_t i = 0; i + window <= size; i++)
+    {
+        lowEntropy[i] = (sum > limit) ? 1 : 0;
+        if (i + window == size)
+        {
+            break;
+        }
+        uint8_t out = pImage[i];
+        sum += cLog2c[counts[out] - 1] - cLog2c[counts[out]];
+        counts[out]--;
+        uint8_t in = pImage[i + window];
+        sum += cLog2c[counts[in] + 1] - cLog2c[counts[in]];
+        counts[in]++;
+    }
+    for (size_t i = size - window + 1; i < size; i++)
+    {
+        lowEntropy[i] = lowEntropy[size - window];
+    }
+}
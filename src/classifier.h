@@ -0,0 +1,75 @@
+/* npd project: classifier.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "decoder.h"
+#include "regionmap.h"
+
+/// @brief Code and data classifier
+/// Scores fixed blocks of the image with a sliding window over four signals:
+///   - unknown opcodes of the linear decode
+///   - JMP and JSB to the middle of an instruction or out of the image
+///   - low byte entropy (fill and padding)
+///   - reachability from the bank entries, following jumps, calls and skips
+/// Runs of data blocks become 'bytes' region suggestions, runs of mostly
+/// printable blocks 'ascii' ones. Reachable blocks are always code.
+///
+/// Every signal is a per byte array and window counts are prefix sum
+/// differences, so the whole pass is linear in the image size.
+class CodeClassifier
+{
+public:
+    CodeClassifier();
+    ~CodeClassifier();
+
+    void Classify(const std::vector<uint8_t> &image, size_t origin, RegionMap &suggestions) const;
+    uint32_t Score(const std::vector<uint8_t> &image, size_t origin) const;
+    bool isUnknown(uint8_t opcode) const { return (m_flags[opcode] & Unknown) != 0; };
+
+    static constexpr size_t BlockSize = 16;
+    static constexpr size_t WindowSize = 64;
+    static constexpr size_t MinRegionSize = 32;
+
+private:
+    void Decode(const uint8_t *pImage, size_t size, size_t origin,
+                std::vector<uint8_t> &unknown, std::vector<uint8_t> &badJump) const;
+    void Reach(const uint8_t *pImage, size_t size, size_t origin, std::vector<uint8_t> &reachable) const;
+    void LowEntropy(const uint8_t *pImage, size_t size, std::vector<uint8_t> &lowEntropy) const;
+    size_t InstructionSize(uint8_t opcode) const { return (m_flags[opcode] & TwoByte) ? 2 : 1; };
+
+private:
+    Decoder m_decoder;
+
+    // Opcode properties
+    enum
+    {
+        Unknown = 0x01,
+        TwoByte = 0x02,
+        Direct = 0x04,
+        Call = 0x08,
+        Stop = 0x10,  // jump or return
+        Skip = 0x20
+    };
+    uint8_t m_flags[256];
+};
@@ -0,0 +1,378 @@
+/* npd project: dataflow.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// UsageAnalysis class implementation
+
+#include <algorithm>  // sort, unique
+
+#include "dataflow.h"
+#include "json.h"
+
+const OperandUsage UsageAnalysis::NoUsage = {0, 0, 0, 0, 0, false};
+
+UsageAnalysis::UsageAnalysis()
+{
+}
+
+UsageAnalysis::~UsageAnalysis()
+{
+}
+
+/// @brief Compute register, device, and control line usage of every subroutine
+void UsageAnalysis::Analyze(const Decoder &decoder,
+                            std::vector<uint8_t> const *pBinary,
+                            size_t size)
+{
+    m_subroutines.clear();
+    BuildBlocks(decoder, pBinary, size);
+    if (m_blocks.empty())
+    {
+        return;
+    }
+
+    // Subroutine entries: reset vector and JSB targets
+    std::vector<uint16_t> entries;
+    entries.push_back(0);
+    for (size_t b = 0; b < m_blocks.size(); b++)
+    {
+        for (size_t c = 0; c < m_blocks[b].calls.size(); c++)
+        {
+            if (BlockAt(m_blocks[b].calls[c]) >= 0)
+            {
+                entries.push_back(m_blocks[b].calls[c]);
+            }
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+    // Local usage: all blocks reachable without following JSB
+    std::vector<size_t> visited(m_blocks.size(), 0);
+    std::vector<int> stack;
+    for (size_t e = 0; e < entries.size(); e++)
+    {
+        SubroutineUsage subroutine;
+        subroutine.address = entries[e];
+        subroutine.usage = NoUsage;
+
+        stack.push_back(BlockAt(entries[e]));
+        visited[stack.back()] = e + 1;
+        while (!stack.empty())
+        {
+            const Block &block = m_blocks[stack.back()];
+            stack.pop_back();
+
+            Merge(subroutine.usage, block.usage);
+            subroutine.calls.insert(subroutine.calls.end(), block.calls.begin(), block.calls.end());
+            for (size_t s = 0; s < block.successors.size(); s++)
+            {
+                int next = BlockAt(block.successors[s]);
+                if ((next >= 0) && (visited[next] != e + 1))
+                {
+                    visited[next] = e + 1;
+                    stack.push_back(next);
+                }
+            }
+        }
+
+        std::sort(subroutine.calls.begin(), subroutine.calls.end());
+        subroutine.calls.erase(std::unique(subroutine.calls.begin(), subroutine.calls.end()),
+                               subroutine.calls.end());
+        m_subroutines.push_back(subroutine);
+    }
+
+    // Propagate callee usage to callers up to a fixed point
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 0; i < m_subroutines.size(); i++)
+        {
+            SubroutineUsage &caller = m_subroutines[i];
+            for (size_t c = 0; c < caller.calls.size(); c++)
+            {
+                const SubroutineUsage *pCallee = Find(caller.calls[c]);
+                if ((pCallee == NULL) || (pCallee == &caller))
+                {
+                    continue;
+                }
+                OperandUsage before = caller.usage;
+                Merge(caller.usage, pCallee->usage);
+                if ( (before.registerReads != caller.usage.registerReads) ||
+                     (before.registerWrites != caller.usage.registerWrites) ||
+                     (before.deviceInputs != caller.usage.deviceInputs) ||
+                     (before.deviceOutputs != caller.usage.deviceOutputs) ||
+                     (before.controlLines != caller.usage.controlLines) ||
+                     (before.indexed != caller.usage.indexed) )
+                {
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+/// @brief Split the linear instruction stream in basic blocks
+void UsageAnalysis::BuildBlocks(const Decoder &decoder,
+                                std::vector<uint8_t> const *pBinary,
+                                size_t size)
+{
+    m_blocks.clear();
+    m_blockIndex.assign(size, -1);
+
+    // Block leaders
+    std::vector<bool> isLeader(size + 3, false);
+    isLeader[0] = true;
+    size_t address = 0;
+    while (address < size)
+    {
+        uint8_t opcode = pBinary->at(address);
+        size_t next = address + 1;
+        if (decoder.isTwoByteInstruction(opcode) && (next < size))
+        {
+            uint8_t parameter = pBinary->at(next++);
+            if (decoder.isDirectAddressing(opcode))
+            {
+                uint16_t target = decoder.DirectAddress(opcode, parameter);
+                if (target < size)
+                {
+                    isLeader[target] = true;
+                }
+            }
+        }
+        if (decoder.isReturnOrJumpInstruction(opcode))
+        {
+            isLeader[next] = true;
+        }
+        // Skip instructions skip over the next two bytes
+        if (decoder.isSkipInstruction(opcode))
+        {
+            isLeader[next] = true;
+            isLeader[address + 3] = true;
+        }
+        address = next;
+    }
+
+    // Build blocks
+    address = 0;
+    while (address < size)
+    {
+        if (isLeader[address] || m_blocks.empty())
+        {
+            Block block;
+            block.start = (uint16_t)address;
+            block.usage = NoUsage;
+            m_blockIndex[address] = (int)m_blocks.size();
+            m_blocks.push_back(block);
+        }
+        Block &block = m_blocks.back();
+
+        uint8_t opcode = pBinary->at(address);
+        uint8_t parameter = 0;
+        size_t next = address + 1;
+        if (decoder.isTwoByteInstruction(opcode) && (next < size))
+        {
+            parameter = pBinary->at(next++);
+        }
+
+        OperandUsage usage;
+        decoder.GetOperandUsage(opcode, usage);
+        Merge(block.usage, usage);
+
+        if (decoder.isSubroutineCall(opcode))
+        {
+            block.calls.push_back(decoder.DirectAddress(opcode, parameter));
+        }
+
+        // Block exits
+        if (decoder.isReturnOrJumpInstruction(opcode))
+        {
+            if (decoder.isDirectAddressing(opcode))
+            {
+                block.successors.push_back(decoder.DirectAddress(opcode, parameter));
+            }
+        }
+        else if (decoder.isSkipInstruction(opcode))
+        {
+            block.successors.push_back((uint16_t)next);
+            block.successors.push_back((uint16_t)(address + 3));
+        }
+        else if ((next < size) && isLeader[next])
+        {
+            block.successors.push_back((uint16_t)next);
+        }
+        address = next;
+    }
+}
+
+/// @brief Subroutine usage by entry address
+/// @return NULL if it is not a subroutine entry
+const SubroutineUsage *UsageAnalysis::Find(uint16_t address) const
+{
+    // Subroutines are sorted by address
+    size_t low = 0;
+    size_t high = m_subroutines.size();
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if (m_subroutines[middle].address < address)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if ((low < m_subroutines.size()) && (m_subroutines[low].address == address))
+    {
+        return &m_subroutines[low];
+    }
+    return NULL;
+}
+
+/// @brief Block index starting at address, -1 if none
+int UsageAnalysis::BlockAt(uint16_t address) const
+{
+    if (address >= m_blockIndex.size())
+    {
+        return -1;
+    }
+    return m_blockIndex[address];
+}
+
+void UsageAnalysis::Merge(OperandUsage &to, const OperandUsage &from) const
+{
+    to.registerReads |= from.registerReads;
+    to.registerWrites |= from.registerWrites;
+    to.deviceInputs |= from.deviceInputs;
+    to.deviceOutputs |= from.deviceOutputs;
+    to.controlLines |= from.controlLines;
+    to.indexed = to.indexed || from.indexed;
+}
+
+/// @brief Append the names of the set bits: 'R0 R5'
+static void AppendMaskNames(uint16_t mask, const char *prefix, std::string &text)
+{
+    for (int bit = 0; bit < 16; bit++)
+    {
+        if (mask & (1 << bit))
+        {
+            text.push_back(' ');
+            text.append(prefix);
+            text.append(std::to_string(bit));
+        }
+    }
+}
+
+/// @brief Usage summary as comment lines
+void UsageAnalysis::UsageComments(const OperandUsage &usage, std::vector<std::string> &comments)
+{
+    std::string text;
+    if (usage.registerReads || usage.indexed)
+    {
+        text = "Registers read:   ";
+        AppendMaskNames(usage.registerReads, "R", text);
+        if (usage.indexed)
+        {
+            text.append(" (indexed)");
+        }
+        comments.push_back(text);
+    }
+    if (usage.registerWrites || usage.indexed)
+    {
+        text = "Registers written:";
+        AppendMaskNames(usage.registerWrites, "R", text);
+        if (usage.indexed)
+        {
+            text.append(" (indexed)");
+        }
+        comments.push_back(text);
+    }
+    if (usage.deviceInputs)
+    {
+        text = "Devices input:    ";
+        AppendMaskNames(usage.deviceInputs, "DS", text);
+        comments.push_back(text);
+    }
+    if (usage.deviceOutputs)
+    {
+        text = "Devices output:   ";
+        AppendMaskNames(usage.deviceOutputs, "DS", text);
+        comments.push_back(text);
+    }
+    if (usage.controlLines)
+    {
+        text = "Control lines:    ";
+        AppendMaskNames(usage.controlLines, "DC", text);
+        comments.push_back(text);
+    }
+}
+
+/// @brief Write a JSON array of the set bits: [0, 5]
+static void WriteJsonMask(std::ostream &outStream, uint16_t mask)
+{
+    outStream << '[';
+    bool first = true;
+    for (int bit = 0; bit < 16; bit++)
+    {
+        if (mask & (1 << bit))
+        {
+            outStream << (first ? "" : ", ") << bit;
+            first = false;
+        }
+    }
+    outStream << ']';
+}
+
+/// @brief Write usage of all subroutines as JSON
+void UsageAnalysis::WriteJson(std::ostream &outStream, const std::string &filename) const
+{
+    outStream << "{\n";
+    outStream << "  \"file\": ";
+    WriteJsonString(outStream, filename);
+    outStream << ",\n";
+    outStream << "  \"subroutines\": [";
+    for (size_t i = 0; i < m_subroutines.size(); i++)
+    {
+        const SubroutineUsage &subroutine = m_subroutines[i];
+        outStream << ((i == 0) ? "\n" : ",\n");
+        outStream << "    {\"address\": " << subroutine.address
+                  << ", \"label\": ";
+        WriteJsonString(outStream, subroutine.name);
+        outStream << ", \"reads\": ";
+        WriteJsonMask(outStream, subroutine.usage.registerReads);
+        outStream << ", \"writes\": ";
+        WriteJsonMask(outStream, subroutine.usage.registerWrites);
+        outStream << ", \"indexed\": " << (subroutine.usage.indexed ? "true" : "false");
+        outStream << ", \"inputs\": ";
+        WriteJsonMask(outStream, subroutine.usage.deviceInputs);
+        outStream << ", \"outputs\": ";
+        WriteJsonMask(outStream, subroutine.usage.deviceOutputs);
+        outStream << ", \"controlLines\": ";
+        WriteJsonMask(outStream, subroutine.usage.controlLines);
+        outStream << ", \"calls\": [";
+        for (size_t c = 0; c < subroutine.calls.size(); c++)
+        {
+            outStream << ((c == 0) ? "" : ", ") << subroutine.calls[c];
+        }
+        outStream << "]}";
+    }
+    outStream << "\n  ]\n}\n";
+}
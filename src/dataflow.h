@@ -0,0 +1,81 @@
+/* npd project: dataflow.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+#include "decoder.h"
+
+/// @brief Registers, devices, and control lines used by a subroutine,
+/// including the subroutines it calls
+struct SubroutineUsage
+{
+    uint16_t address;
+    std::string name;
+    OperandUsage usage;
+    std::vector<uint16_t> calls;
+};
+
+/// @brief Register and device usage analysis
+/// Code is split in basic blocks with 16-bit usage masks. Each subroutine
+/// (reset entry and JSB targets) collects the masks of the blocks it
+/// reaches, then usage is propagated through JSB calls to a fixed point.
+class UsageAnalysis
+{
+public:
+    UsageAnalysis();
+    ~UsageAnalysis();
+
+    void Analyze(const Decoder &decoder,
+                 std::vector<uint8_t> const *pBinary,
+                 size_t size);
+
+    std::vector<SubroutineUsage> &Subroutines() { return m_subroutines; };
+    const SubroutineUsage *Find(uint16_t address) const;
+
+    static void UsageComments(const OperandUsage &usage, std::vector<std::string> &comments);
+    void WriteJson(std::ostream &outStream, const std::string &filename) const;
+
+private:
+    struct Block
+    {
+        uint16_t start;
+        OperandUsage usage;
+        std::vector<uint16_t> successors;
+        std::vector<uint16_t> calls;
+    };
+
+    void BuildBlocks(const Decoder &decoder,
+                     std::vector<uint8_t> const *pBinary,
+                     size_t size);
+    void Merge(OperandUsage &to, const OperandUsage &from) const;
+    int BlockAt(uint16_t address) const;
+
+private:
+    std::vector<Block> m_blocks;
+    // Block index of each address, -1 if it is not a block start
+    std::vector<int> m_blockIndex;
+    std::vector<SubroutineUsage> m_subroutines;
+
+    static const OperandUsage NoUsage;
+};
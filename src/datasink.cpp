@@ -0,0 +1,414 @@
+/* npd project: datasink.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// Machine readable output sinks implementation
+
+#include <iostream>
+
+#include "datasink.h"
+#include "json.h"
+
+/// @brief Split a translated instruction in mnemonic and operand: "LDA", "R5"
+static void SplitMnemonic(const std::string &text, std::string &mnemonic, std::string &operand)
+{
+    size_t blank = text.find(' ');
+    mnemonic = text.substr(0, blank);
+    operand.erase();
+    if (blank != std::string::npos)
+    {
+        size_t start = text.find_first_not_of(' ', blank);
+        if (start != std::string::npos)
+        {
+            operand = text.substr(start);
+        }
+    }
+}
+
+//------------------------------------------------------------
+// JsonLinesSink
+//------------------------------------------------------------
+
+JsonLinesSink::JsonLinesSink(bool hexMode, std::ostream& outStream)
+: m_outStream(outStream)
+{
+    m_instructionCount = 0;
+    if (hexMode)
+    {
+        m_decoder.SetHexMode();
+    }
+    else
+    {
+        m_decoder.SetOctalMode();
+    }
+}
+
+JsonLinesSink::~JsonLinesSink()
+{
+}
+
+void JsonLinesSink::Begin(const ListingHeader &header)
+{
+    m_instructionCount = 0;
+    m_outStream << "{\"type\":\"header\",\"schema\":" << SchemaVersion << ",\"npd\":";
+    WriteJsonString(m_outStream, header.version);
+    m_outStream << ",\"file\":";
+    WriteJsonString(m_outStream, header.filename);
+    m_outStream << ",\"size\":" << header.size << ",\"date\":";
+    WriteJsonString(m_outStream, header.date);
+    m_outStream << ",\"hex\":" << (m_decoder.isHexMode() ? "true" : "false") << "}\n";
+}
+
+void JsonLinesSink::Write(const ListingLine &line)
+{
+    std::string text;
+    switch (line.type)
+    {
+        case ListingLine::Comment:
+        case ListingLine::Window:
+            if (line.type == ListingLine::Window)
+            {
+                WindowText(m_decoder, line, text);
+            }
+            m_outStream << "{\"type\":\"comment\",\"text\":";
+            WriteJsonString(m_outStream, (line.type == ListingLine::Window) ? text : line.text);
+            m_outStream << "}\n";
+            break;
+
+        case ListingLine::Label:
+            if (line.text.empty())
+            {
+                text = "L_";
+                m_decoder.AppendAddressString(line.address, text);
+            }
+            m_outStream << "{\"type\":\"label\",\"address\":" << line.address << ",\"name\":";
+            WriteJsonString(m_outStream, line.text.empty() ? text : line.text);
+            m_outStream << "}\n";
+            break;
+
+        case ListingLine::Instruction:
+        {
+            std::string translation;
+            std::string comment;
+            std::string mnemonic;
+            std::string operand;
+            InstructionText(m_decoder, line, translation, comment);
+            SplitMnemonic(translation, mnemonic, operand);
+
+            m_outStream << "{\"type\":\"instruction\",\"address\":" << line.address
+                        << ",\"bytes\":[" << (int)line.opcode;
+            if (line.size > 1)
+            {
+                m_outStream << ',' << (int)line.parameter;
+            }
+            m_outStream << "],\"mnemonic\":";
+            WriteJsonString(m_outStream, mnemonic);
+            m_outStream << ",\"operand\":";
+            WriteJsonString(m_outStream, operand);
+            m_outStream << ",\"comment\":";
+            WriteJsonString(m_outStream, comment);
+
+            const char *flow = "next";
+            if (m_decoder.isSubroutineCall(line.opcode))
+            {
+                flow = "call";
+            }
+            else if (m_decoder.isReturnOrJumpInstruction(line.opcode))
+            {
+                flow = "jump";
+            }
+            else if (m_decoder.isSkipInstruction(line.opcode))
+            {
+                flow = "skip";
+            }
+            m_outStream << ",\"flow\":\"" << flow << '"';
+            if (m_decoder.isDirectAddressing(line.opcode))
+            {
+                m_outStream << ",\"target\":" << m_decoder.BankedAddress(line.address, line.opcode, line.parameter);
+            }
+            m_outStream << "}\n";
+            m_instructionCount++;
+            break;
+        }
+
+        case ListingLine::Idiom:
+            ExpandIdiomText(m_decoder, line, text);
+            m_outStream << "{\"type\":\"idiom\",\"start\":" << line.address
+                        << ",\"end\":" << line.endAddress
+                        << ",\"count\":" << line.count << ",\"text\":";
+            WriteJsonString(m_outStream, text);
+            m_outStream << "}\n";
+            break;
+
+        case ListingLine::Data:
+            DataText(m_decoder, line, text);
+            m_outStream << "{\"type\":\"data\",\"address\":" << line.address
+                        << ",\"format\":\"" << RegionMap::TypeName(line.dataType) << "\",\"bytes\":[";
+            for (size_t i = 0; i < line.count; i++)
+            {
+                m_outStream << ((i > 0) ? "," : "") << (int)line.data[i];
+            }
+            m_outStream << "],\"text\":";
+            WriteJsonString(m_outStream, text);
+            m_outStream << "}\n";
+            break;
+
+        case ListingLine::SkipBar:
+        case ListingLine::JumpBar:
+            // Layout only. Instructions carry their "flow"
+            break;
+    }
+}
+
+void JsonLinesSink::Finish()
+{
+    m_outStream << "{\"type\":\"end\",\"instructions\":" << m_instructionCount << "}\n";
+    m_outStream.flush();
+}
+
+//------------------------------------------------------------
+// BinarySink
+//------------------------------------------------------------
+
+BinarySink::BinarySink(bool hexMode, std::ostream& outStream)
+: m_outStream(outStream)
+{
+    m_offset = 0;
+    m_instructionCount = 0;
+    m_pendingLabel = NoLabel;
+    m_fileName = 0;
+    m_date = 0;
+    if (hexMode)
+    {
+        m_decoder.SetHexMode();
+    }
+    else
+    {
+        m_decoder.SetOctalMode();
+    }
+}
+
+BinarySink::~BinarySink()
+{
+}
+
+void BinarySink::Begin(const ListingHeader &header)
+{
+    m_instructionCount = 0;
+    m_pendingLabel = NoLabel;
+    m_labels.clear();
+    m_notes.clear();
+    m_pool.assign(1, '\0');  // offset 0: empty string
+    m_poolIndex.clear();
+    m_poolIndex[""] = 0;
+    m_fileName = PoolString(header.filename);
+    m_date = PoolString(header.date);
+
+    m_outStream.write("NPDB", 4);
+    Put16(FormatVersion);
+    Put16(m_decoder.isHexMode() ? 1 : 0);
+    Put32((uint32_t)header.size);
+    Put32(InstructionSize);
+    m_offset = HeaderSize;
+}
+
+void BinarySink::Write(const ListingLine &line)
+{
+    std::string text;
+    Note note;
+    switch (line.type)
+    {
+        case ListingLine::Comment:
+        case ListingLine::Window:
+            // Comment lines come before the instruction they refer to
+            if (line.type == ListingLine::Window)
+            {
+                WindowText(m_decoder, line, text);
+            }
+            note.instruction = m_instructionCount;
+            note.text = PoolString((line.type == ListingLine::Window) ? text : line.text);
+            note.kind = 0;
+            m_notes.push_back(note);
+            break;
+
+        case ListingLine::Label:
+        {
+            Label label;
+            label.address = line.address;
+            if (line.text.empty())
+            {
+                text = "L_";
+                m_decoder.AppendAddressString(line.address, text);
+            }
+            label.name = PoolString(line.text.empty() ? text : line.text);
+            m_pendingLabel = (uint16_t)m_labels.size();
+            m_labels.push_back(label);
+            break;
+        }
+
+        case ListingLine::Instruction:
+        {
+            std::string comment;
+            InstructionText(m_decoder, line, text, comment);
+
+            uint8_t flags = 0;
+            if (m_decoder.isSubroutineCall(line.opcode))
+            {
+                flags |= FlagCall;
+            }
+            else if (m_decoder.isReturnOrJumpInstruction(line.opcode))
+            {
+                flags |= FlagJump;
+            }
+            if (m_decoder.isSkipInstruction(line.opcode))
+            {
+                flags |= FlagSkip;
+            }
+            if (m_pendingLabel != NoLabel)
+            {
+                flags |= FlagLabel;
+            }
+
+            Put16(line.address);
+            Put8(line.opcode);
+            Put8(line.parameter);
+            Put8(line.size);
+            Put8(flags);
+            Put16(m_pendingLabel);
+            Put32(PoolString(text));
+            Put32(PoolString(comment));
+            m_offset += InstructionSize;
+            m_instructionCount++;
+            m_pendingLabel = NoLabel;
+            break;
+        }
+
+        case ListingLine::Idiom:
+            // Idioms end at the last written instruction
+            ExpandIdiomText(m_decoder, line, text);
+            note.instruction = (m_instructionCount > 0) ? m_instructionCount - 1 : 0;
+            note.text = PoolString(text);
+            note.kind = 1;
+            m_notes.push_back(note);
+            break;
+
+        case ListingLine::Data:
+        {
+            // Data lines are records with the directive as mnemonic
+            DataText(m_decoder, line, text);
+            uint8_t flags = FlagData;
+            if (m_pendingLabel != NoLabel)
+            {
+                flags |= FlagLabel;
+            }
+            Put16(line.address);
+            Put8(line.data[0]);
+            Put8((line.count > 1) ? line.data[1] : 0);
+            Put8((uint8_t)line.count);
+            Put8(flags);
+            Put16(m_pendingLabel);
+            Put32(PoolString(text));
+            Put32(0);
+            m_offset += InstructionSize;
+            m_instructionCount++;
+            m_pendingLabel = NoLabel;
+            break;
+        }
+
+        case ListingLine::SkipBar:
+        case ListingLine::JumpBar:
+            // Layout only. Instructions carry their flow flags
+            break;
+    }
+}
+
+/// @brief Write tables, string pool, and trailer
+void BinarySink::Finish()
+{
+    uint32_t instructionOffset = HeaderSize;
+
+    uint32_t labelOffset = m_offset;
+    for (size_t i = 0; i < m_labels.size(); i++)
+    {
+        Put16(m_labels[i].address);
+        Put16(0);
+        Put32(m_labels[i].name);
+    }
+    m_offset += (uint32_t)m_labels.size() * LabelSize;
+
+    uint32_t noteOffset = m_offset;
+    for (size_t i = 0; i < m_notes.size(); i++)
+    {
+        Put32(m_notes[i].instruction);
+        Put32(m_notes[i].text);
+        Put16(m_notes[i].kind);
+        Put16(0);
+    }
+    m_offset += (uint32_t)m_notes.size() * NoteSize;
+
+    // Keep the trailer 4-byte aligned
+    uint32_t poolOffset = m_offset;
+    while (m_pool.size() % 4)
+    {
+        m_pool.push_back('\0');
+    }
+    m_outStream.write(m_pool.data(), m_pool.size());
+    m_offset += (uint32_t)m_pool.size();
+
+    Put32(instructionOffset);
+    Put32(m_instructionCount);
+    Put32(labelOffset);
+    Put32((uint32_t)m_labels.size());
+    Put32(noteOffset);
+    Put32((uint32_t)m_notes.size());
+    Put32(poolOffset);
+    Put32((uint32_t)m_pool.size());
+    Put32(m_fileName);
+    Put32(m_date);
+    m_outStream.write("NPDE", 4);
+    Put32(FormatVersion);
+    m_offset += TrailerSize;
+    m_outStream.flush();
+}
+
+/// @brief String pool offset of a text. Equal strings are stored once
+uint32_t BinarySink::PoolString(const std::string &text)
+{
+    std::map<std::string, uint32_t>::const_iterator it = m_poolIndex.find(text);
+    if (it != m_poolIndex.end())
+    {
+        return it->second;
+    }
+    uint32_t offset = (uint32_t)m_pool.size();
+    m_pool.append(text);
+    m_pool.push_back('\0');
+    m_poolIndex[text] = offset;
+    return offset;
+}
+
+void BinarySink::Put16(uint16_t x)
+{
+    Put8((uint8_t)(x & 0xFF));
+    Put8((uint8_t)(x >> 8));
+}
+
+void BinarySink::Put32(uint32_t x)
+{
+    Put16((uint16_t)(x & 0xFFFF));
+    Put16((uint16_t)(x >> 16));
+}
@@ -0,0 +1,143 @@
+/* npd project: datasink.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <cstdint>
+
+#include "decoder.h"
+#include "sink.h"
+
+/// @brief JSON Lines output: one JSON object per line
+///
+/// Schema (version 1). Every object has a "type" field:
+///   header       {"type":"header","schema":1,"npd":VERSION,"file":NAME,"size":N,"date":DATE,"hex":BOOL}
+///   label        {"type":"label","address":N,"name":NAME}
+///   instruction  {"type":"instruction","address":N,"bytes":[N,...],"mnemonic":TEXT,
+///                 "operand":TEXT,"comment":TEXT,"flow":"next"|"jump"|"skip"|"call","target":N}
+///                 ("target" only for JMP and JSB)
+///   comment      {"type":"comment","text":TEXT}
+///   idiom        {"type":"idiom","start":N,"end":N,"count":N,"text":TEXT}
+///   data         {"type":"data","address":N,"format":"bytes"|"words"|"ascii",
+///                 "bytes":[N,...],"text":DIRECTIVE}
+///   end          {"type":"end","instructions":N}
+/// Numbers are decimal integers. Text fields use the sink numeric mode.
+class JsonLinesSink : public OutputSink
+{
+public:
+    JsonLinesSink(bool hexMode, std::ostream& outStream);
+    virtual ~JsonLinesSink();
+
+    virtual void Begin(const ListingHeader &header);
+    virtual void Write(const ListingLine &line);
+    virtual void Finish();
+
+    static constexpr int SchemaVersion = 1;
+
+private:
+    Decoder m_decoder;
+    std::ostream& m_outStream;
+    size_t m_instructionCount;
+};
+
+/// @brief Compact binary output, mmap friendly
+///
+/// Layout (version 1). All integers are little endian.
+///   Header (16 bytes)       "NPDB", u16 version, u16 flags (bit 0: hex),
+///                           u32 image size, u32 instruction record size (16)
+///   Instruction records     u16 address, u8 opcode, u8 parameter, u8 size,
+///   (16 bytes each)         u8 flags, u16 label index (0xFFFF: none),
+///                           u32 mnemonic offset, u32 comment offset
+///                           Data lines (flag 0x10): opcode and parameter are
+///                           the first two bytes, size the byte count, and
+///                           mnemonic the data directive
+///   Label table (8 bytes)   u16 address, u16 reserved, u32 name offset
+///   Note table (12 bytes)   u32 instruction index, u32 text offset,
+///                           u16 kind (0: comment before, 1: idiom after), u16 reserved
+///   String pool             '\0' terminated strings. Offset 0 is ""
+///   Trailer (48 bytes)      u32 offset and count of: instructions, labels, notes;
+///                           u32 pool offset and size; u32 file name and date offsets;
+///                           "NPDE", u32 version
+///
+/// Instruction records are streamed as they are decoded. The tables, the
+/// pool and the trailer are written at the end: a reader maps the file,
+/// reads the trailer from its last 48 bytes and indexes records directly.
+class BinarySink : public OutputSink
+{
+public:
+    BinarySink(bool hexMode, std::ostream& outStream);
+    virtual ~BinarySink();
+
+    virtual void Begin(const ListingHeader &header);
+    virtual void Write(const ListingLine &line);
+    virtual void Finish();
+
+    static constexpr uint16_t FormatVersion = 1;
+    static constexpr uint32_t HeaderSize = 16;
+    static constexpr uint32_t InstructionSize = 16;
+    static constexpr uint32_t LabelSize = 8;
+    static constexpr uint32_t NoteSize = 12;
+    static constexpr uint32_t TrailerSize = 48;
+
+    // Instruction flags
+    static constexpr uint8_t FlagJump = 0x01;
+    static constexpr uint8_t FlagSkip = 0x02;
+    static constexpr uint8_t FlagCall = 0x04;
+    static constexpr uint8_t FlagLabel = 0x08;
+    static constexpr uint8_t FlagData = 0x10;
+
+private:
+    uint32_t PoolString(const std::string &text);
+    void Put8(uint8_t x) { m_outStream.put((char)x); };
+    void Put16(uint16_t x);
+    void Put32(uint32_t x);
+
+private:
+    Decoder m_decoder;
+    std::ostream& m_outStream;
+    uint32_t m_offset;
+
+    uint32_t m_instructionCount;
+    uint16_t m_pendingLabel;  // label index of the next instruction
+
+    struct Label
+    {
+        uint16_t address;
+        uint32_t name;
+    };
+    struct Note
+    {
+        uint32_t instruction;
+        uint32_t text;
+        uint16_t kind;
+    };
+    std::vector<Label> m_labels;
+    std::vector<Note> m_notes;
+
+    std::string m_pool;
+    std::map<std::string, uint32_t> m_poolIndex;
+    uint32_t m_fileName;
+    uint32_t m_date;
+
+    static constexpr uint16_t NoLabel = 0xFFFF;
+};
@@ -21,6 +21,7 @@
 
 #include <iostream>
 #include <iomanip> //std::hex oct
+#include <sstream>
 
 #include "decoder.h"
 
@@ -34,7 +35,7 @@ Decoder::~Decoder()
 }
 
 /// @brief Translate opcode, returning mnemonic and comment strings
-void Decoder::TranslateOpCode(uint8_t opcode, uint8_t parameter, std::string &mnemonic, std::string &comment)
+void Decoder::TranslateOpCode(uint8_t opcode, uint8_t parameter, std::string &mnemonic, std::string &comment) const
 {
     mnemonic = "???";
     comment = "Unknow Opcode!";
@@ -189,6 +190,113 @@ bool Decoder::isSkipInstruction(uint8_t opcode) const
              (Clear3bits(opcode) == SFZ_opcode) );
 }
 
+/// @brief Registers, devices, and control lines an opcode uses
+void Decoder::GetOperandUsage(uint8_t opcode, OperandUsage &usage) const
+{
+    usage.registerReads = 0;
+    usage.registerWrites = 0;
+    usage.deviceInputs = 0;
+    usage.deviceOutputs = 0;
+    usage.controlLines = 0;
+    usage.indexed = false;
+
+    uint16_t bit4 = (uint16_t)(1 << Mask4bits(opcode));
+    uint8_t bit3 = (uint8_t)(1 << Mask3bits(opcode));
+
+    // Simple opcodes overlap operand opcodes (i.e. 'NOP' and 'OTA DS15')
+    for (size_t i = 0; i < SimpleDirectOpCode.size(); i++)
+    {
+        if (opcode == SimpleDirectOpCode[i].opcode)
+        {
+            // Comparisons against R0
+            if ( (opcode == SGT_opcode) ||
+                 (opcode == SLT_opcode) ||
+                 (opcode == SEQ_opcode) ||
+                 (opcode == SLE_opcode) ||
+                 (opcode == SGE_opcode) ||
+                 (opcode == SNE_opcode) )
+            {
+                usage.registerReads = 1;
+            }
+            return;
+        }
+    }
+
+    // 'LDR' (11001111) must be checked before 'OTR' (1100xxxx)
+    if (opcode == LDR_opcode)
+    {
+        return;
+    }
+
+    switch (Clear4bits(opcode))
+    {
+        case LDA_opcode:
+            usage.registerReads = bit4;
+            return;
+        case STA_opcode:
+        case STR_opcode:
+            usage.registerWrites = bit4;
+            return;
+        case LDI_opcode:
+        case STI_opcode:
+            // The register is selected by the index register R0
+            usage.registerReads = 1;
+            usage.indexed = true;
+            return;
+        case INA_opcode:
+            usage.deviceInputs = bit4;
+            return;
+        case OTA_opcode:
+        case OTR_opcode:
+            usage.deviceOutputs = bit4;
+            return;
+        default:
+            break;
+    }
+
+    switch (Clear3bits(opcode))
+    {
+        case STC_opcode:
+        case CLC_opcode:
+            usage.controlLines = bit3;
+            return;
+        default:
+            break;
+    }
+}
+
+/// @brief All instruction forms, built from the instruction set tables
+void Decoder::GetInstructionForms(std::vector<InstructionForm> &forms)
+{
+    forms.clear();
+    AddInstructionForms(SimpleDirectOpCode, InstructionForm::NoOperand, forms);
+    AddInstructionForms(std::vector<Instruction>(1, DoubleDirectOpCode), InstructionForm::ByteOperand, forms);
+    AddInstructionForms(DoublePagedOpCode, InstructionForm::Address, forms);
+    AddInstructionForms(Single3bitOpCode, InstructionForm::Bits3, forms);
+    AddInstructionForms(Single4bitOpCode, InstructionForm::Bits4, forms);
+    AddInstructionForms(Double4bitOpCode, InstructionForm::Bits4Byte, forms);
+}
+
+/// @brief Split table mnemonics ("LDA  R") in mnemonic and operand prefix
+void Decoder::AddInstructionForms(const std::vector<Instruction> &table,
+                                  InstructionForm::OperandType operand,
+                                  std::vector<InstructionForm> &forms)
+{
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        InstructionForm form;
+        form.opcode = table[i].opcode;
+        form.mnemonic = table[i].mnemonic.substr(0, 3);
+        size_t prefix = table[i].mnemonic.find_first_not_of(' ', 3);
+        if (prefix != std::string::npos)
+        {
+            form.prefix = table[i].mnemonic.substr(prefix);
+        }
+        form.operand = operand;
+        forms.push_back(form);
+    }
+}
+
 uint16_t Decoder::DirectAddress(uint8_t opcode, uint8_t parameter) const
 {
     uint16_t address = (uint16_t)(parameter);       // second byte = offset
@@ -196,8 +304,15 @@ uint16_t Decoder::DirectAddress(uint8_t opcode, uint8_t parameter) const
     return address;
 }
 
+/// @brief JMP or JSB target of the instruction at 'address'
+/// Banked images: the target is in the bank of the instruction
+uint16_t Decoder::BankedAddress(uint16_t address, uint8_t opcode, uint8_t parameter) const
+{
+    return (uint16_t)((address & ~(BankSize - 1)) | DirectAddress(opcode, parameter));
+}
+
 /// @brief Append string representing a simple decimal number
-void Decoder::AppendNumberString(uint8_t x, std::string &out)
+void Decoder::AppendNumberString(uint8_t x, std::string &out) const
 {
 	std::stringstream stream;
     stream << std::setw(1) << std::dec << (int) x;
@@ -205,7 +320,7 @@ void Decoder::AppendNumberString(uint8_t x, std::string &out)
 }
 
 /// @brief Append string representing a byte number in hex or octal
-void Decoder::AppendByteString(uint8_t x, std::string &out)
+void Decoder::AppendByteString(uint8_t x, std::string &out) const
 {
 	std::stringstream stream;
     stream << std::setfill ('0');
@@ -225,7 +340,7 @@ void Decoder::AppendByteString(uint8_t x, std::string &out)
 }
 
 /// @brief Append string representing a double byte number in hex or octal
-void Decoder::AppendAddressString(uint16_t x, std::string &out)
+void Decoder::AppendAddressString(uint16_t x, std::string &out) const
 {
 	std::stringstream stream;
 	stream << std::setfill ('0') << std::setw(4);
@@ -21,6 +21,7 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 
 /// @brief Nanoprocessor opcode, instruction, and description
 struct Instruction
@@ -30,6 +31,37 @@ struct Instruction
     std::string comment;
 };
 
+/// @brief Assembler view of an instruction
+struct InstructionForm
+{
+    enum OperandType
+    {
+        NoOperand,    // INB
+        ByteOperand,  // LDR 017
+        Address,      // JMP L_0013
+        Bits3,        // SFS DC2
+        Bits4,        // LDA R5
+        Bits4Byte     // STR R0,017
+    };
+
+    uint8_t opcode;        // opcode with a zero operand
+    std::string mnemonic;  // "LDA"
+    std::string prefix;    // operand prefix: "R", "DS", "DC", "L_", or ""
+    OperandType operand;
+};
+
+/// @brief Registers, devices, and control lines used by an instruction
+/// Bit n of each mask stands for R<n>, DS<n>, or DC<n>
+struct OperandUsage
+{
+    uint16_t registerReads;
+    uint16_t registerWrites;
+    uint16_t deviceInputs;
+    uint16_t deviceOutputs;
+    uint8_t controlLines;
+    bool indexed;  // LDI/STI: register selected at run time
+};
+
 /// @brief Nanoprocessor opcode translation class
 class Decoder
 {
@@ -37,28 +69,40 @@ public:
     Decoder();
     ~Decoder();
 
-    void TranslateOpCode(uint8_t opcode, uint8_t parameter, std::string &mnemonic, std::string &comment);
+    void TranslateOpCode(uint8_t opcode, uint8_t parameter, std::string &mnemonic, std::string &comment) const;
     void SetHexMode() { m_hex = true; };
     void SetOctalMode() { m_hex = false; };
 
-    void AppendByteString(uint8_t x, std::string &out);
-    void AppendAddressString(uint16_t x, std::string &out);
+    void AppendByteString(uint8_t x, std::string &out) const;
+    void AppendAddressString(uint16_t x, std::string &out) const;
 
     bool isHexMode() const { return m_hex; };
     bool isDirectAddressing(uint8_t opcode) const;
     bool isTwoByteInstruction(uint8_t opcode) const;
     bool isReturnOrJumpInstruction(uint8_t opcode) const;
     bool isSkipInstruction(uint8_t opcode) const;
+    bool isSubroutineCall(uint8_t opcode) const { return (Clear3bits(opcode) == JSB_opcode); };
+
+    void GetOperandUsage(uint8_t opcode, OperandUsage &usage) const;
+    static void GetInstructionForms(std::vector<InstructionForm> &forms);
     
     uint16_t DirectAddress(uint8_t opcode, uint8_t parameter) const;
+    uint16_t BankedAddress(uint16_t address, uint8_t opcode, uint8_t parameter) const;
+    uint8_t DirectAddressingOpCode(uint8_t opcode) const { return Clear3bits(opcode); };
+
+    // JMP and JSB reach 11 address bits: a 2K bank
+    static constexpr uint16_t BankSize = 2048;
     
 private:
-    void AppendNumberString(uint8_t x, std::string &out);
+    void AppendNumberString(uint8_t x, std::string &out) const;
+    static void AddInstructionForms(const std::vector<Instruction> &table,
+                                    InstructionForm::OperandType operand,
+                                    std::vector<InstructionForm> &forms);
     uint8_t Mask3bits(uint8_t x) const { return (x & 0b00000111); };
     uint8_t Mask4bits(uint8_t x) const { return (x & 0b00001111); };
     uint8_t Clear3bits(uint8_t x) const { return (x & 0b11111000); };
     uint8_t Clear4bits(uint8_t x) const { return (x & 0b11110000); };
-    
+
 private:
     bool m_hex;
 
@@ -0,0 +1,363 @@
+/* npd project: idiom.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// IdiomMatcher class implementation
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>  // unique
+#include <map>
+#include <deque>
+
+#include "idiom.h"
+
+IdiomMatcher::IdiomMatcher()
+{
+    m_maxPatternSize = 0;
+    m_classCount = 1;
+    std::fill(m_opcodeClass, m_opcodeClass + 256, 0);
+    // A single state automaton that never matches
+    m_delta.assign(m_classCount, 0);
+    m_matches.resize(1);
+}
+
+IdiomMatcher::~IdiomMatcher()
+{
+}
+
+/// @brief Load and compile a rules file
+/// @return false on file or rule errors
+bool IdiomMatcher::Load(const std::string &filename, const Decoder &decoder)
+{
+    std::ifstream inStream(filename.c_str());
+    if (!inStream.is_open())
+    {
+        std::cerr << "Error reading file '" << filename << "'\n";
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(inStream, line))
+    {
+        lineNumber++;
+        // Skip blank and comment lines
+        size_t first = line.find_first_not_of(" \t\r");
+        if ((first == std::string::npos) || (line[first] == '#'))
+        {
+            continue;
+        }
+
+        size_t separator = line.find('=');
+        if (separator == std::string::npos)
+        {
+            std::cerr << "Missing '=' at " << filename << ":" << lineNumber << std::endl;
+            return false;
+        }
+
+        IdiomRule rule;
+        size_t start = line.find_first_not_of(" \t", separator + 1);
+        size_t end = line.find_last_not_of(" \t\r");
+        if ((start != std::string::npos) && (end >= start))
+        {
+            rule.comment = line.substr(start, end - start + 1);
+        }
+
+        // Split pattern elements, normalizing case and blanks
+        std::string pattern = line.substr(first, separator - first) + "/";
+        std::string element;
+        for (size_t i = 0; i < pattern.size(); i++)
+        {
+            char c = pattern[i];
+            if (c == '/')
+            {
+                if (!element.empty() && (element[element.size()-1] == ' '))
+                {
+                    element.erase(element.size()-1);
+                }
+                if (element.empty())
+                {
+                    std::cerr << "Empty pattern element at " << filename << ":" << lineNumber << std::endl;
+                    return false;
+                }
+                rule.pattern.push_back(element);
+                element.erase();
+            }
+            else if ((c == ' ') || (c == '\t'))
+            {
+                if (!element.empty() && (element[element.size()-1] != ' '))
+                {
+                    element.push_back(' ');
+                }
+            }
+            else
+            {
+                element.push_back((char)toupper(c));
+            }
+        }
+        m_rules.push_back(rule);
+    }
+
+    if (!Compile(decoder))
+    {
+        std::cerr << "Invalid rules file '" << filename << "'\n";
+        return false;
+    }
+    return true;
+}
+
+/// @brief Compile all rules into a single automaton
+bool IdiomMatcher::Compile(const Decoder &decoder)
+{
+    // Opcode names to match against
+    std::vector<std::string> names(256);
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        OpCodeName(decoder, (uint8_t)opcode, names[opcode]);
+    }
+
+    // Opcode set of each pattern element
+    std::vector<std::vector<std::vector<bool> > > opcodeSets(m_rules.size());
+    m_maxPatternSize = 0;
+    for (size_t r = 0; r < m_rules.size(); r++)
+    {
+        const std::vector<std::string> &pattern = m_rules[r].pattern;
+        m_maxPatternSize = std::max(m_maxPatternSize, pattern.size());
+        for (size_t e = 0; e < pattern.size(); e++)
+        {
+            std::vector<bool> opcodes(256, false);
+            bool any = false;
+            for (int opcode = 0; opcode < 256; opcode++)
+            {
+                opcodes[opcode] = GlobMatch(pattern[e].c_str(), names[opcode].c_str());
+                any = any || opcodes[opcode];
+            }
+            if (!any)
+            {
+                std::cerr << "No opcode matches '" << pattern[e] << "'\n";
+                return false;
+            }
+            opcodeSets[r].push_back(opcodes);
+        }
+    }
+
+    // Partition opcodes in classes: refine by every pattern element set
+    std::fill(m_opcodeClass, m_opcodeClass + 256, 0);
+    m_classCount = 1;
+    for (size_t r = 0; r < opcodeSets.size(); r++)
+    {
+        for (size_t e = 0; e < opcodeSets[r].size(); e++)
+        {
+            std::map<std::pair<int, bool>, uint8_t> refined;
+            for (int opcode = 0; opcode < 256; opcode++)
+            {
+                std::pair<int, bool> key(m_opcodeClass[opcode], opcodeSets[r][e][opcode]);
+                if (refined.count(key) == 0)
+                {
+                    uint8_t newClass = (uint8_t)refined.size();
+                    refined[key] = newClass;
+                }
+                m_opcodeClass[opcode] = refined[key];
+            }
+            m_classCount = refined.size();
+        }
+    }
+
+    // Trie root
+    m_delta.assign(m_classCount, UINT32_MAX);
+    m_matches.assign(1, std::vector<uint16_t>());
+
+    for (size_t r = 0; r < m_rules.size(); r++)
+    {
+        // Class set of each pattern element
+        std::vector<std::vector<uint8_t> > classes;
+        for (size_t e = 0; e < opcodeSets[r].size(); e++)
+        {
+            std::vector<uint8_t> classSet;
+            for (int opcode = 0; opcode < 256; opcode++)
+            {
+                if (opcodeSets[r][e][opcode])
+                {
+                    classSet.push_back(m_opcodeClass[opcode]);
+                }
+            }
+            std::sort(classSet.begin(), classSet.end());
+            classSet.erase(std::unique(classSet.begin(), classSet.end()), classSet.end());
+            classes.push_back(classSet);
+        }
+
+        if (!Insert((uint16_t)r, classes))
+        {
+            std::cerr << "Too many wildcards. Automaton exceeds " << MaxStates << " states\n";
+            return false;
+        }
+    }
+
+    BuildAutomaton();
+    return true;
+}
+
+/// @brief Insert a rule into the trie, expanding its class sets
+bool IdiomMatcher::Insert(uint16_t rule, const std::vector<std::vector<uint8_t> > &classes)
+{
+    // Depth first expansion: (trie node, pattern element)
+    std::vector<std::pair<uint32_t, size_t> > stack;
+    stack.push_back(std::make_pair(0u, (size_t)0));
+
+    while (!stack.empty())
+    {
+        uint32_t node = stack.back().first;
+        size_t element = stack.back().second;
+        stack.pop_back();
+
+        if (element == classes.size())
+        {
+            m_matches[node].push_back(rule);
+            continue;
+        }
+
+        for (size_t i = 0; i < classes[element].size(); i++)
+        {
+            size_t edge = (node * m_classCount) + classes[element][i];
+            if (m_delta[edge] == UINT32_MAX)
+            {
+                if (m_matches.size() >= MaxStates)
+                {
+                    return false;
+                }
+                m_delta[edge] = (uint32_t)m_matches.size();
+                m_delta.resize(m_delta.size() + m_classCount, UINT32_MAX);
+                m_matches.push_back(std::vector<uint16_t>());
+            }
+            stack.push_back(std::make_pair(m_delta[edge], element + 1));
+        }
+    }
+    return true;
+}
+
+/// @brief Turn the trie into a complete transition table (Aho-Corasick)
+void IdiomMatcher::BuildAutomaton()
+{
+    std::vector<uint32_t> fail(m_matches.size(), 0);
+    std::deque<uint32_t> queue;
+
+    for (size_t c = 0; c < m_classCount; c++)
+    {
+        uint32_t next = m_delta[c];
+        if (next == UINT32_MAX)
+        {
+            m_delta[c] = 0;
+        }
+        else
+        {
+            fail[next] = 0;
+            queue.push_back(next);
+        }
+    }
+
+    // Breadth first: failure states are always resolved first
+    while (!queue.empty())
+    {
+        uint32_t state = queue.front();
+        queue.pop_front();
+
+        const std::vector<uint16_t> &inherited = m_matches[fail[state]];
+        m_matches[state].insert(m_matches[state].end(), inherited.begin(), inherited.end());
+
+        for (size_t c = 0; c < m_classCount; c++)
+        {
+            size_t edge = (state * m_classCount) + c;
+            uint32_t fallback = m_delta[(fail[state] * m_classCount) + c];
+            if (m_delta[edge] == UINT32_MAX)
+            {
+                m_delta[edge] = fallback;
+            }
+            else
+            {
+                fail[m_delta[edge]] = fallback;
+                queue.push_back(m_delta[edge]);
+            }
+        }
+    }
+}
+
+/// @brief Opcode name without its parameter byte: 'LDA R5', 'OTR DS3', 'JMP'
+void IdiomMatcher::OpCodeName(const Decoder &decoder, uint8_t opcode, std::string &name)
+{
+    std::string mnemonic;
+    std::string comment;
+    decoder.TranslateOpCode(opcode, 0, mnemonic, comment);
+
+    // Remove parameter byte
+    if (decoder.isTwoByteInstruction(opcode))
+    {
+        size_t comma = mnemonic.find(',');
+        mnemonic.erase((comma == std::string::npos) ? 3 : comma);
+    }
+
+    // Single blank between mnemonic and operand
+    name.erase();
+    for (size_t i = 0; i < mnemonic.size(); i++)
+    {
+        if (mnemonic[i] != ' ')
+        {
+            if ((i > 0) && (mnemonic[i-1] == ' ') && !name.empty())
+            {
+                name.push_back(' ');
+            }
+            name.push_back(mnemonic[i]);
+        }
+    }
+}
+
+/// @brief Match text against a pattern with '*' and '?' wildcards
+bool IdiomMatcher::GlobMatch(const char *pattern, const char *text)
+{
+    const char *star = NULL;
+    const char *retry = NULL;
+
+    while (*text != '\0')
+    {
+        if ((*pattern == '?') || (*pattern == *text))
+        {
+            pattern++;
+            text++;
+        }
+        else if (*pattern == '*')
+        {
+            star = pattern++;
+            retry = text;
+        }
+        else if (star != NULL)
+        {
+            pattern = star + 1;
+            text = ++retry;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*pattern == '*')
+    {
+        pattern++;
+    }
+    return (*pattern == '\0');
+}
@@ -0,0 +1,87 @@
+/* npd project: idiom.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "decoder.h"
+
+/// @brief Idiom rule: instruction pattern and comment template
+struct IdiomRule
+{
+    std::vector<std::string> pattern;
+    std::string comment;
+};
+
+/// @brief Multi-pattern instruction idiom matcher
+/// Rules file, one rule per line: 'PATTERN = COMMENT'.
+/// PATTERN is a list of instructions separated by '/'. Each instruction
+/// is a mnemonic and its opcode operand ('LDA R5', 'SFS DC1', 'JMP'),
+/// '*' and '?' wildcards allowed. Parameter bytes are not matched.
+/// COMMENT may include '$s' (first address), '$e' (last address), and
+/// '$n' (instruction count). Lines starting with '#' are comments.
+///
+/// All rules are compiled into a single Aho-Corasick automaton over
+/// opcode classes, so matching costs one table lookup per instruction
+/// whatever the number of rules.
+class IdiomMatcher
+{
+public:
+    IdiomMatcher();
+    ~IdiomMatcher();
+
+    bool Load(const std::string &filename, const Decoder &decoder);
+
+    bool empty() const { return m_rules.empty(); };
+    size_t MaxPatternSize() const { return m_maxPatternSize; };
+    const IdiomRule &Rule(size_t i) const { return m_rules.at(i); };
+
+    uint32_t Start() const { return 0; };
+    uint32_t Next(uint32_t state, uint8_t opcode) const
+    {
+        return m_delta[(state * m_classCount) + m_opcodeClass[opcode]];
+    };
+    const std::vector<uint16_t> &Matches(uint32_t state) const { return m_matches[state]; };
+
+private:
+    bool Compile(const Decoder &decoder);
+    bool Insert(uint16_t rule, const std::vector<std::vector<uint8_t> > &classes);
+    void BuildAutomaton();
+
+    static void OpCodeName(const Decoder &decoder, uint8_t opcode, std::string &name);
+    static bool GlobMatch(const char *pattern, const char *text);
+
+private:
+    std::vector<IdiomRule> m_rules;
+    size_t m_maxPatternSize;
+
+    // Opcodes matched by the same pattern elements share a class
+    uint8_t m_opcodeClass[256];
+    size_t m_classCount;
+
+    // Automaton transition table (state x class) and matched rules
+    std::vector<uint32_t> m_delta;
+    std::vector<std::vector<uint16_t> > m_matches;
+
+    // Keeps wildcard heavy rules from exploding the automaton
+    static constexpr size_t MaxStates = 65536;
+};
@@ -0,0 +1,361 @@
+/* npd project: interleave.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// ImageMerger class implementation
+
+#include <iostream>
+#include <sstream>
+#include <cstdlib>  // strtoul
+#include <algorithm>  // next_permutation, sort
+
+#include "interleave.h"
+#include "classifier.h"
+#include "checksum.h"
+
+ImageMerger::ImageMerger()
+{
+    m_mode = None;
+    m_permuteBits = false;
+    for (int i = 0; i < 256; i++)
+    {
+        m_bitTable[i] = (uint8_t)i;
+    }
+}
+
+ImageMerger::~ImageMerger()
+{
+}
+
+/// @brief Interleave mode: 'nibble' or 'byte'
+bool ImageMerger::SetMode(const std::string &name)
+{
+    if (name == "nibble")
+    {
+        m_mode = Nibble;
+    }
+    else if (name == "byte")
+    {
+        m_mode = Byte;
+    }
+    else
+    {
+        std::cerr << "Invalid interleave mode '" << name << "'\n";
+        return false;
+    }
+    return true;
+}
+
+/// @brief Source bits of image bits 7 down to 0
+bool ImageMerger::SetBitOrder(const std::string &list)
+{
+    std::vector<unsigned> order;
+    unsigned used = 0;
+    if (ParseList(list, order) && (order.size() == 8))
+    {
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            used |= (order[i] < 8) ? (1u << order[i]) : 0x100;
+        }
+    }
+    if (used != 0xFF)
+    {
+        std::cerr << "Invalid bit order '" << list << "'\n";
+        return false;
+    }
+
+    SetBitTable(order);
+    return true;
+}
+
+/// @brief Compile a bit order to the lookup table
+void ImageMerger::SetBitTable(const std::vector<unsigned> &order)
+{
+    // Image bit (7 - i) comes from source bit order[i]
+    for (int x = 0; x < 256; x++)
+    {
+        uint8_t y = 0;
+        for (size_t i = 0; i < 8; i++)
+        {
+            y |= (uint8_t)(((x >> order[i]) & 1) << (7 - i));
+        }
+        m_bitTable[x] = y;
+    }
+    m_bitOrder = order;
+    m_permuteBits = true;
+}
+
+/// @brief Source address lines of image lines An down to A0
+bool ImageMerger::SetAddressOrder(const std::string &list)
+{
+    std::vector<unsigned> order;
+    unsigned long used = 0;
+    if (ParseList(list, order) && !order.empty() && (order.size() <= 24))
+    {
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            used |= (order[i] < order.size()) ? (1ul << order[i]) : (1ul << 31);
+        }
+    }
+    if ((order.empty()) || (used != (1ul << order.size()) - 1))
+    {
+        std::cerr << "Invalid address order '" << list << "'\n";
+        return false;
+    }
+    m_addressOrder.assign(order.rbegin(), order.rend());
+    return true;
+}
+
+/// @brief Merge the input dumps into the image
+/// @return false if the inputs do not fit the interleave mode
+bool ImageMerger::Merge(const std::vector<std::vector<uint8_t> > &inputs, std::vector<uint8_t> &image) const
+{
+    size_t count = inputs.size();
+    if ((count == 0) || ((m_mode == None) && (count != 1)) ||
+        ((m_mode == Nibble) && (count != 2)) || ((m_mode == Byte) && (count < 2)))
+    {
+        std::cerr << "Wrong number of input files for the interleave mode\n";
+        return false;
+    }
+    for (size_t i = 1; i < count; i++)
+    {
+        if (inputs[i].size() != inputs[0].size())
+        {
+            std::cerr << "Input files of different sizes\n";
+            return false;
+        }
+    }
+
+    switch (m_mode)
+    {
+        case Nibble:
+            MergeNibbles(inputs[0], inputs[1], image);
+            break;
+        case Byte:
+            MergeBytes(inputs, image);
+            break;
+        default:
+            image = inputs[0];
+            break;
+    }
+
+    if (m_permuteBits)
+    {
+        PermuteBits(image);
+    }
+    return m_addressOrder.empty() || PermuteAddresses(image);
+}
+
+/// @brief Rank the dump orders and data bit orders of the inputs, most likely first.
+/// Candidates matching all the checksums come first, then the lowest classifier scores
+/// @return false if the inputs do not fit the interleave mode
+bool ImageMerger::SearchOrders(const std::vector<std::vector<uint8_t> > &inputs, size_t origin,
+                               const CodeClassifier &classifier, const ChecksumVerifier &checksums,
+                               std::vector<Candidate> &ranking) const
+{
+    if (inputs.size() > MaxSearchFiles)
+    {
+        std::cerr << "Order search takes up to " << MaxSearchFiles << " input files\n";
+        return false;
+    }
+    bool searchBits = !m_permuteBits;
+    ImageMerger merger(*this);
+    Decoder decoder;
+
+    std::vector<size_t> files(inputs.size());
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        files[i] = i;
+    }
+    do
+    {
+        std::vector<std::vector<uint8_t> > dumps;
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            dumps.push_back(inputs[files[i]]);
+        }
+        // Bits of the searched orders are permuted per candidate
+        merger.m_permuteBits = !searchBits;
+        std::vector<uint8_t> raw;
+        if (!merger.Merge(dumps, raw))
+        {
+            return false;
+        }
+
+        // Bit orders of this dump order, by the unknown opcodes of the byte histogram
+        std::vector<std::vector<unsigned> > bitOrders;
+        if (searchBits)
+        {
+            uint32_t histogram[256] = { 0 };
+            for (size_t i = 0; i < raw.size(); i++)
+            {
+                histogram[raw[i]]++;
+            }
+            std::vector<std::pair<uint32_t, std::vector<unsigned> > > counts;
+            std::vector<unsigned> order = { 0, 1, 2, 3, 4, 5, 6, 7 };
+            do
+            {
+                merger.SetBitTable(order);
+                uint32_t unknown = 0;
+                for (int x = 0; x < 256; x++)
+                {
+                    unknown += classifier.isUnknown(merger.m_bitTable[x]) ? histogram[x] : 0;
+                }
+                counts.push_back(std::make_pair(unknown, order));
+            } while (std::next_permutation(order.begin(), order.end()));
+            size_t keep = std::min(counts.size(), BitOrdersPerFileOrder);
+            std::partial_sort(counts.begin(), counts.begin() + keep, counts.end());
+            for (size_t i = 0; i < keep; i++)
+            {
+                bitOrders.push_back(counts[i].second);
+            }
+        }
+        else
+        {
+            bitOrders.push_back(m_bitOrder);
+        }
+
+        // Score the merged candidates
+        for (size_t i = 0; i < bitOrders.size(); i++)
+        {
+            Candidate candidate;
+            candidate.files = files;
+            candidate.bits = bitOrders[i];
+            std::vector<uint8_t> image(raw);
+            if (searchBits)
+            {
+                merger.SetBitTable(candidate.bits);
+                merger.PermuteBits(image);
+            }
+            std::vector<std::string> report;
+            candidate.verified = !checksums.empty() && checksums.Verify(image, origin, decoder, report);
+            candidate.score = classifier.Score(image, origin);
+            ranking.push_back(candidate);
+        }
+    } while (std::next_permutation(files.begin(), files.end()));
+
+    std::stable_sort(ranking.begin(), ranking.end(), [](const Candidate &a, const Candidate &b) {
+        return (a.verified != b.verified) ? a.verified : (a.score < b.score);
+    });
+    return true;
+}
+
+bool ImageMerger::ParseList(const std::string &list, std::vector<unsigned> &values)
+{
+    std::string item;
+    std::istringstream items(list);
+    while (std::getline(items, item, ','))
+    {
+        char *end;
+        unsigned long value = strtoul(item.c_str(), &end, 10);
+        if (item.empty() || (*end != '\0'))
+        {
+            return false;
+        }
+        values.push_back((unsigned)value);
+    }
+    return true;
+}
+
+void ImageMerger::MergeNibbles(const std::vector<uint8_t> &high, const std::vector<uint8_t> &low,
+                               std::vector<uint8_t> &image) const
+{
+    size_t size = high.size();
+    image.resize(size);
+    const uint8_t *pHigh = high.data();
+    const uint8_t *pLow = low.data();
+    uint8_t *pImage = image.data();
+    for (size_t i = 0; i < size; i++)
+    {
+        pImage[i] = (uint8_t)((pHigh[i] << 4) | (pLow[i] & 0x0F));
+    }
+}
+
+void ImageMerger::MergeBytes(const std::vector<std::vector<uint8_t> > &inputs, std::vector<uint8_t> &image) const
+{
+    size_t count = inputs.size();
+    size_t size = inputs[0].size();
+    image.resize(size * count);
+    uint8_t *pImage = image.data();
+
+    // Two dumps, the usual even/odd pair
+    if (count == 2)
+    {
+        const uint8_t *pEven = inputs[0].data();
+        const uint8_t *pOdd = inputs[1].data();
+        for (size_t i = 0; i < size; i++)
+        {
+            pImage[2 * i] = pEven[i];
+            pImage[(2 * i) + 1] = pOdd[i];
+        }
+        return;
+    }
+
+    for (size_t k = 0; k < count; k++)
+    {
+        const uint8_t *pInput = inputs[k].data();
+        for (size_t i = 0; i < size; i++)
+        {
+            pImage[(i * count) + k] = pInput[i];
+        }
+    }
+}
+
+void ImageMerger::PermuteBits(std::vector<uint8_t> &image) const
+{
+    uint8_t *pImage = image.data();
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        pImage[i] = m_bitTable[pImage[i]];
+    }
+}
+
+/// @brief Reorder the image by its address lines
+bool ImageMerger::PermuteAddresses(std::vector<uint8_t> &image) const
+{
+    size_t lines = m_addressOrder.size();
+    if (image.size() != ((size_t)1 << lines))
+    {
+        std::cerr << "Address order of " << lines << " lines needs a "
+                  << ((size_t)1 << lines) << " bytes image\n";
+        return false;
+    }
+
+    // Source address of each image address, one address line at a time:
+    // source(a) = source(a without its lowest set bit) | source(lowest set bit)
+    std::vector<uint32_t> source(image.size());
+    source[0] = 0;
+    for (size_t line = 0; line < lines; line++)
+    {
+        size_t bit = (size_t)1 << line;
+        uint32_t sourceBit = (uint32_t)1 << m_addressOrder[line];
+        for (size_t a = 0; a < bit; a++)
+        {
+            source[bit + a] = source[a] | sourceBit;
+        }
+    }
+
+    std::vector<uint8_t> scrambled(image);
+    const uint8_t *pScrambled = scrambled.data();
+    uint8_t *pImage = image.data();
+    for (size_t a = 0; a < image.size(); a++)
+    {
+        pImage[a] = pScrambled[source[a]];
+    }
+    return true;
+}
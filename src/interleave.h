@@ -0,0 +1,104 @@
+/* npd project: interleave.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class CodeClassifier;
+class ChecksumVerifier;
+
+/// @brief Merge of split PROM dumps into one image
+/// Interleave modes:
+///   nibble  two dumps of 4-bit PROMs, data in the low 4 bits of each byte.
+///           The first dump holds the high nibble.
+///   byte    two or more dumps of interleaved EPROMs. Dump k holds the
+///           image bytes k, k+N, k+2N... (N dumps: even/odd for two)
+/// Then, optionally, data lines and address lines are unscrambled:
+///   bit order      source data bit of image bits 7 down to 0, i.e. '0,1,2,3,4,5,6,7'
+///   address order  source address line of image lines An down to A0.
+///                  A list of n lines needs an image of 2^n bytes
+///
+/// The permutations are compiled to lookup tables, and all the loops are
+/// branch free over plain arrays, so the compiler can vectorize them when
+/// brute forcing candidate permutations.
+///
+/// SearchOrders brute forces the dump order and, unless set, the data bit
+/// order: the 8! bit orders are first ranked on the unknown opcodes of a byte
+/// histogram, 256 lookups each, and the best ones of each dump order merged
+/// and scored by the classifier. Address orders are not searched: n! orders
+/// of n lines are too many.
+class ImageMerger
+{
+public:
+    /// @brief Candidate of an order search
+    struct Candidate
+    {
+        std::vector<size_t> files;    // input of each dump position
+        std::vector<unsigned> bits;   // source bits of image bits 7 down to 0
+        bool verified;                // all checksums match
+        uint32_t score;               // classifier data score, code is low
+    };
+
+    static constexpr size_t MaxSearchFiles = 4;
+    static constexpr size_t BitOrdersPerFileOrder = 256;
+
+    enum Mode
+    {
+        None,
+        Nibble,
+        Byte
+    };
+
+    ImageMerger();
+    ~ImageMerger();
+
+    bool SetMode(const std::string &name);
+    bool SetBitOrder(const std::string &list);
+    bool SetAddressOrder(const std::string &list);
+    bool isActive() const { return (m_mode != None) || m_permuteBits || !m_addressOrder.empty(); };
+
+    bool Merge(const std::vector<std::vector<uint8_t> > &inputs, std::vector<uint8_t> &image) const;
+    bool SearchOrders(const std::vector<std::vector<uint8_t> > &inputs, size_t origin,
+                      const CodeClassifier &classifier, const ChecksumVerifier &checksums,
+                      std::vector<Candidate> &ranking) const;
+
+private:
+    void SetBitTable(const std::vector<unsigned> &order);
+    static bool ParseList(const std::string &list, std::vector<unsigned> &values);
+    void MergeNibbles(const std::vector<uint8_t> &high, const std::vector<uint8_t> &low,
+                      std::vector<uint8_t> &image) const;
+    void MergeBytes(const std::vector<std::vector<uint8_t> > &inputs, std::vector<uint8_t> &image) const;
+    void PermuteBits(std::vector<uint8_t> &image) const;
+    bool PermuteAddresses(std::vector<uint8_t> &image) const;
+
+private:
+    Mode m_mode;
+
+    // Data bit permutation table
+    bool m_permuteBits;
+    std::vector<unsigned> m_bitOrder;
+    uint8_t m_bitTable[256];
+
+    // Source address line of each image address line, A0 first
+    std::vector<unsigned> m_addressOrder;
+};
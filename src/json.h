@@ -0,0 +1,49 @@
+/* npd project: json.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <cstdio>
+
+/// @brief Write a quoted and escaped JSON string
+inline void WriteJsonString(std::ostream &outStream, const std::string &text)
+{
+    outStream << '"';
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        if ((c == '"') || (c == '\\'))
+        {
+            outStream << '\\' << c;
+        }
+        else if (c < 0x20)
+        {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            outStream << buffer;
+        }
+        else
+        {
+            outStream << c;
+        }
+    }
+    outStream << '"';
+}
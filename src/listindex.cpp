@@ -0,0 +1,216 @@
+/* npd project: listindex.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// ListingIndex class implementation
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>  // lower_bound, upper_bound
+
+#include "listindex.h"
+
+static void Put16(std::ostream &out, uint16_t x)
+{
+    out.put((char)(x & 0xFF));
+    out.put((char)(x >> 8));
+}
+
+static void Put32(std::ostream &out, uint32_t x)
+{
+    Put16(out, (uint16_t)(x & 0xFFFF));
+    Put16(out, (uint16_t)(x >> 16));
+}
+
+static uint16_t Get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t Get32(const uint8_t *p)
+{
+    return Get16(p) | ((uint32_t)Get16(p + 2) << 16);
+}
+
+ListingIndex::ListingIndex()
+{
+}
+
+ListingIndex::~ListingIndex()
+{
+}
+
+void ListingIndex::Clear()
+{
+    m_entries.clear();
+    m_labels.clear();
+}
+
+/// @brief Add the line of an address. Addresses may not decrease
+/// Only the first line of an address is kept
+void ListingIndex::Add(uint16_t address, uint32_t line, uint64_t offset)
+{
+    if (!m_entries.empty() && (m_entries.back().address >= address))
+    {
+        return;
+    }
+    Entry entry;
+    entry.address = address;
+    entry.line = line;
+    entry.offset = offset;
+    m_entries.push_back(entry);
+}
+
+/// @brief Add the line of a labelled address
+void ListingIndex::AddLabel(const std::string &name, uint16_t address, uint32_t line, uint64_t offset)
+{
+    Add(address, line, offset);
+    if (m_entries.empty() || (m_entries.back().address != address))
+    {
+        return;
+    }
+
+    Label label;
+    label.name = name;
+    label.entry = (uint32_t)(m_entries.size() - 1);
+    std::vector<Label>::iterator it = std::lower_bound(m_labels.begin(), m_labels.end(), label,
+        [](const Label &a, const Label &b) { return a.name < b.name; });
+    m_labels.insert(it, label);
+}
+
+/// @brief Write the index file
+/// @return false if the file can't be written
+bool ListingIndex::Save(const std::string &filename) const
+{
+    std::ofstream outStream(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!outStream.is_open())
+    {
+        std::cerr << "Error writing file " << filename << std::endl;
+        return false;
+    }
+
+    outStream.write("NPDX", 4);
+    Put16(outStream, FormatVersion);
+    Put16(outStream, 0);
+    Put32(outStream, (uint32_t)m_entries.size());
+    Put32(outStream, (uint32_t)m_labels.size());
+
+    for (size_t i = 0; i < m_entries.size(); i++)
+    {
+        Put16(outStream, m_entries[i].address);
+        Put16(outStream, 0);
+        Put32(outStream, m_entries[i].line);
+        Put32(outStream, (uint32_t)(m_entries[i].offset & 0xFFFFFFFF));
+        Put32(outStream, (uint32_t)(m_entries[i].offset >> 32));
+    }
+
+    uint32_t nameOffset = 0;
+    for (size_t i = 0; i < m_labels.size(); i++)
+    {
+        Put32(outStream, m_labels[i].entry);
+        Put32(outStream, nameOffset);
+        nameOffset += (uint32_t)m_labels[i].name.size() + 1;
+    }
+    for (size_t i = 0; i < m_labels.size(); i++)
+    {
+        outStream.write(m_labels[i].name.c_str(), m_labels[i].name.size() + 1);
+    }
+    return outStream.good();
+}
+
+/// @brief Read an index file
+/// @return false if the file can't be read or is not an index
+bool ListingIndex::Load(const std::string &filename)
+{
+    Clear();
+    std::ifstream inStream(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!inStream.is_open())
+    {
+        std::cerr << "Error reading file '" << filename << "'\n";
+        return false;
+    }
+    std::vector<uint8_t> file(std::istreambuf_iterator<char>(inStream), {});
+
+    // Check the header and the table sizes
+    bool valid = (file.size() >= HeaderSize) && std::equal(file.begin(), file.begin() + 4, "NPDX") &&
+                 (Get16(&file[4]) == FormatVersion);
+    size_t entryCount = valid ? Get32(&file[8]) : 0;
+    size_t labelCount = valid ? Get32(&file[12]) : 0;
+    size_t pool = HeaderSize + (entryCount * EntrySize) + (labelCount * LabelSize);
+    if (!valid || (file.size() < pool))
+    {
+        std::cerr << "Invalid index file '" << filename << "'\n";
+        return false;
+    }
+
+    const uint8_t *p = &file[HeaderSize];
+    for (size_t i = 0; i < entryCount; i++, p += EntrySize)
+    {
+        Entry entry;
+        entry.address = Get16(p);
+        entry.line = Get32(p + 4);
+        entry.offset = Get32(p + 8) | ((uint64_t)Get32(p + 12) << 32);
+        m_entries.push_back(entry);
+    }
+    for (size_t i = 0; i < labelCount; i++, p += LabelSize)
+    {
+        Label label;
+        label.entry = Get32(p);
+        size_t name = pool + Get32(p + 4);
+        size_t nameEnd = name;
+        while ((nameEnd < file.size()) && (file[nameEnd] != 0))
+        {
+            nameEnd++;
+        }
+        if ((label.entry >= entryCount) || (nameEnd >= file.size()))
+        {
+            std::cerr << "Invalid index file '" << filename << "'\n";
+            Clear();
+            return false;
+        }
+        label.name.assign(file.begin() + name, file.begin() + nameEnd);
+        m_labels.push_back(label);
+    }
+    return true;
+}
+
+/// @brief Line of an address, or of the closest address before it
+/// @return NULL if the address is before the listing
+const ListingIndex::Entry *ListingIndex::Find(uint16_t address) const
+{
+    std::vector<Entry>::const_iterator it = std::upper_bound(m_entries.begin(), m_entries.end(), address,
+        [](uint16_t x, const Entry &entry) { return x < entry.address; });
+    if (it == m_entries.begin())
+    {
+        return NULL;
+    }
+    return &*(it - 1);
+}
+
+/// @brief Line of a label
+/// @return NULL if unknown
+const ListingIndex::Entry *ListingIndex::FindLabel(const std::string &name) const
+{
+    std::vector<Label>::const_iterator it = std::lower_bound(m_labels.begin(), m_labels.end(), name,
+        [](const Label &label, const std::string &x) { return label.name < x; });
+    if ((it == m_labels.end()) || (it->name != name))
+    {
+        return NULL;
+    }
+    return &m_entries[it->entry];
+}
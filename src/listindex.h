@@ -0,0 +1,79 @@
+/* npd project: listindex.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/// @brief Listing index: where the line of an address or a label starts
+///
+/// Sidecar file layout (version 1). All integers are little endian.
+///   Header (16 bytes)       "NPDX", u16 version, u16 reserved,
+///                           u32 entry count, u32 label count
+///   Entries (16 bytes)      u16 address, u16 reserved, u32 line number (1 based),
+///                           u64 byte offset. In listing order
+///   Labels (8 bytes)        u32 entry index, u32 name offset. Sorted by name
+///   String pool             '\0' terminated names
+///
+/// An address has one entry, at its first line: the label line if labelled.
+/// Find and FindLabel are binary searches over the loaded tables.
+class ListingIndex
+{
+public:
+    struct Entry
+    {
+        uint16_t address;
+        uint32_t line;
+        uint64_t offset;
+    };
+
+    ListingIndex();
+    ~ListingIndex();
+
+    void Clear();
+    void Add(uint16_t address, uint32_t line, uint64_t offset);
+    void AddLabel(const std::string &name, uint16_t address, uint32_t line, uint64_t offset);
+
+    bool Save(const std::string &filename) const;
+    bool Load(const std::string &filename);
+
+    size_t size() const { return m_entries.size(); };
+    const Entry &at(size_t i) const { return m_entries.at(i); };
+    const Entry *Find(uint16_t address) const;
+    const Entry *FindLabel(const std::string &name) const;
+
+    static constexpr uint16_t FormatVersion = 1;
+    static constexpr uint32_t HeaderSize = 16;
+    static constexpr uint32_t EntrySize = 16;
+    static constexpr uint32_t LabelSize = 8;
+
+private:
+    struct Label
+    {
+        std::string name;
+        uint32_t entry;
+    };
+
+    // Entries in address order, labels in name order
+    std::vector<Entry> m_entries;
+    std::vector<Label> m_labels;
+};
@@ -0,0 +1,384 @@
+/* npd project: loader.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// ImageLoader class implementation
+
+#include <iostream>
+#include <fstream>
+#include <cstring>  // memcpy
+#include <algorithm>  // min, max
+
+#include "loader.h"
+
+ImageLoader::ImageLoader()
+{
+    m_format = Auto;
+    m_loadedFormat = Auto;
+    m_fill = 0xFF;  // erased EPROM
+    m_lineNumber = 0;
+    m_base = 0;
+    m_top = 0;
+    m_empty = true;
+    m_upperAddress = 0;
+    m_endRecord = false;
+
+    for (int i = 0; i < 256; i++)
+    {
+        m_hexValue[i] = -1;
+    }
+    for (int i = 0; i < 10; i++)
+    {
+        m_hexValue['0' + i] = (int8_t)i;
+    }
+    for (int i = 0; i < 6; i++)
+    {
+        m_hexValue['A' + i] = (int8_t)(10 + i);
+        m_hexValue['a' + i] = (int8_t)(10 + i);
+    }
+}
+
+ImageLoader::~ImageLoader()
+{
+}
+
+/// @brief Load an image file
+/// @return false on read or record errors
+bool ImageLoader::Load(const std::string &filename, std::vector<uint8_t> &image)
+{
+    m_filename = filename;
+    m_lineNumber = 0;
+    m_base = 0;
+    m_top = 0;
+    m_empty = true;
+    m_upperAddress = 0;
+    m_endRecord = false;
+    m_data.clear();
+    m_segments.clear();
+    image.clear();
+
+    std::ifstream inStream(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!inStream.is_open())
+    {
+        std::cerr << "Error reading file '" << filename << "'\n";
+        return false;
+    }
+
+    m_loadedFormat = (m_format == Auto) ? Detect(inStream) : m_format;
+    if (m_loadedFormat == Binary)
+    {
+        image.assign(std::istreambuf_iterator<char>(inStream), {});
+        return true;
+    }
+    return LoadRecords(inStream, image);
+}
+
+/// @brief Guess the format from the first line
+/// A text format only if the whole line is a valid record: raw ROMs may
+/// start with ':' or 'S' and a digit
+ImageLoader::Format ImageLoader::Detect(std::istream &inStream)
+{
+    // Longest record line, with some trailing blanks
+    static const size_t MaxLineSize = 1024;
+    std::string line;
+    char c;
+    while ((line.size() < MaxLineSize) && inStream.get(c) && (c != '\n'))
+    {
+        if (c != '\r')
+        {
+            line.push_back(c);
+        }
+    }
+    bool ended = (line.size() < MaxLineSize);
+    inStream.clear();
+    inStream.seekg(0);
+
+    if (ended && (RecordError(line, IntelHex) == NULL))
+    {
+        return IntelHex;
+    }
+    if (ended && (RecordError(line, SRecord) == NULL))
+    {
+        return SRecord;
+    }
+    return Binary;
+}
+
+/// @brief Decode a record line into m_record, and check its length and checksum
+/// @return Error message, NULL if valid
+const char *ImageLoader::RecordError(const std::string &line, Format format)
+{
+    if (format == IntelHex)
+    {
+        // ':' count, address, type, data, checksum
+        if (line.empty() || (line[0] != ':') || !DecodeBytes(line, 1))
+        {
+            return "Invalid Intel HEX record";
+        }
+        if ((m_record.size() < 5) || (m_record.size() != (size_t)m_record[0] + 5))
+        {
+            return "Invalid record length";
+        }
+    }
+    else
+    {
+        // 'S' type, count, address, data, checksum
+        if ((line.size() < 2) || (line[0] != 'S') || !DecodeBytes(line, 2))
+        {
+            return "Invalid S-record";
+        }
+        if ((m_record.size() < 3) || (m_record.size() != (size_t)m_record[0] + 1))
+        {
+            return "Invalid record length";
+        }
+    }
+
+    uint8_t sum = 0;
+    for (size_t i = 0; i < m_record.size(); i++)
+    {
+        sum += m_record[i];
+    }
+    if (sum != ((format == IntelHex) ? 0 : 0xFF))
+    {
+        return "Checksum error";
+    }
+    return NULL;
+}
+
+/// @brief Parse text records, one block of the file at a time
+bool ImageLoader::LoadRecords(std::istream &inStream, std::vector<uint8_t> &image)
+{
+    static const size_t BlockSize = 65536;
+    std::vector<char> block(BlockSize);
+    std::string line;
+    line.reserve(600);  // longest record: 255 data bytes
+
+    bool ok = true;
+    while (ok && !m_endRecord && inStream)
+    {
+        inStream.read(block.data(), BlockSize);
+        size_t count = (size_t)inStream.gcount();
+        for (size_t i = 0; ok && !m_endRecord && (i <= count); i++)
+        {
+            // The end of the file ends the last line
+            bool lastLine = (i == count) && (count < BlockSize);
+            if ((i < count) && (block[i] != '\n'))
+            {
+                if (block[i] != '\r')
+                {
+                    line.push_back(block[i]);
+                }
+                continue;
+            }
+            if ((i == count) && !lastLine)
+            {
+                break;
+            }
+
+            m_lineNumber++;
+            if (!line.empty())
+            {
+                ok = (m_loadedFormat == IntelHex) ? IntelHexRecord(line) : SRecordRecord(line);
+            }
+            line.clear();
+        }
+    }
+
+    if (ok && m_empty)
+    {
+        return Error("No data records");
+    }
+    if (ok)
+    {
+        // Records in any order: one copy into the whole image
+        image.assign(m_top - m_base, m_fill);
+        for (size_t i = 0; i < m_segments.size(); i++)
+        {
+            const Segment &segment = m_segments[i];
+            memcpy(&image[segment.address - m_base], &m_data[segment.offset], segment.size);
+        }
+    }
+    return ok;
+}
+
+/// @brief ':' count, address, type, data, checksum
+bool ImageLoader::IntelHexRecord(const std::string &line)
+{
+    const char *pError = RecordError(line, IntelHex);
+    if (pError != NULL)
+    {
+        return Error(pError);
+    }
+
+    size_t address = ((size_t)m_record[1] << 8) | m_record[2];
+    const uint8_t *pData = &m_record[4];
+    size_t size = m_record[0];
+    switch (m_record[3])
+    {
+        case 0x00:  // data
+            return Store(m_upperAddress + address, pData, size);
+        case 0x01:  // end of file
+            m_endRecord = true;
+            return true;
+        case 0x02:  // extended segment address
+            if (size != 2)
+            {
+                return Error("Invalid segment address record");
+            }
+            m_upperAddress = (((size_t)pData[0] << 8) | pData[1]) << 4;
+            return true;
+        case 0x04:  // extended linear address
+            if (size != 2)
+            {
+                return Error("Invalid linear address record");
+            }
+            m_upperAddress = (((size_t)pData[0] << 8) | pData[1]) << 16;
+            return true;
+        case 0x03:  // start segment address
+        case 0x05:  // start linear address
+            return true;
+        default:
+            return Error("Unknown record type");
+    }
+}
+
+/// @brief 'S' type, count, address, data, checksum
+bool ImageLoader::SRecordRecord(const std::string &line)
+{
+    const char *pError = RecordError(line, SRecord);
+    if (pError != NULL)
+    {
+        return Error(pError);
+    }
+
+    // Address size of each record type
+    static const size_t AddressSize[10] = {2, 2, 3, 4, 0, 2, 3, 4, 3, 2};
+    char type = line[1];
+    size_t addressSize = ((type >= '0') && (type <= '9')) ? AddressSize[type - '0'] : 0;
+    if ((addressSize == 0) || (m_record.size() < addressSize + 2))
+    {
+        return Error("Invalid S-record type");
+    }
+
+    size_t address = 0;
+    for (size_t i = 1; i <= addressSize; i++)
+    {
+        address = (address << 8) | m_record[i];
+    }
+    switch (type)
+    {
+        case '1':
+        case '2':
+        case '3':  // data
+            return Store(address, &m_record[addressSize + 1], m_record.size() - addressSize - 2);
+        case '7':
+        case '8':
+        case '9':  // end
+            m_endRecord = true;
+            return true;
+        default:  // header and record counts
+            return true;
+    }
+}
+
+/// @brief Decode the hexadecimal digit pairs of a line, from 'first'
+bool ImageLoader::DecodeBytes(const std::string &line, size_t first)
+{
+    size_t size = line.size();
+    while ((size > first) && ((line[size-1] == ' ') || (line[size-1] == '\t')))
+    {
+        size--;
+    }
+    if ((size - first) % 2)
+    {
+        return false;
+    }
+
+    m_record.resize((size - first) / 2);
+    for (size_t i = 0; i < m_record.size(); i++)
+    {
+        int high = m_hexValue[(uint8_t)line[first + (2 * i)]];
+        int low = m_hexValue[(uint8_t)line[first + (2 * i) + 1]];
+        if ((high < 0) || (low < 0))
+        {
+            return false;
+        }
+        m_record[i] = (uint8_t)((high << 4) | low);
+    }
+    return true;
+}
+
+/// @brief Keep record data for the image, and extend its address span
+bool ImageLoader::Store(size_t address, const uint8_t *pData, size_t size)
+{
+    if (size == 0)
+    {
+        return true;
+    }
+    size_t base = m_empty ? address : std::min(m_base, address);
+    size_t top = m_empty ? address + size : std::max(m_top, address + size);
+    if (top - base > MaxImageSpan)
+    {
+        return Error("Records span too many addresses");
+    }
+    m_base = base;
+    m_top = top;
+    m_empty = false;
+
+    Segment segment;
+    segment.address = address;
+    segment.offset = m_data.size();
+    segment.size = size;
+    m_segments.push_back(segment);
+    m_data.insert(m_data.end(), pData, pData + size);
+    return true;
+}
+
+bool ImageLoader::Error(const std::string &message) const
+{
+    std::cerr << message << " at " << m_filename << ":" << m_lineNumber << std::endl;
+    return false;
+}
+
+bool ImageLoader::ParseFormat(const std::string &name, Format &format)
+{
+    for (int i = Auto; i <= SRecord; i++)
+    {
+        if (name == FormatName((Format)i))
+        {
+            format = (Format)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *ImageLoader::FormatName(Format format)
+{
+    switch (format)
+    {
+        case Binary:
+            return "bin";
+        case IntelHex:
+            return "ihex";
+        case SRecord:
+            return "srec";
+        default:
+            return "auto";
+    }
+}
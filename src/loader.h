@@ -0,0 +1,104 @@
+/* npd project: loader.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <cstdint>
+#include <cstddef>
+
+/// @brief Input image loader: raw binary, Intel HEX, or Motorola S-records
+/// Text formats are parsed in a single streaming pass. Record data is
+/// kept as read and copied once into the image, so records in any order
+/// load in linear time. Record checksums are verified. Records may be
+/// sparse or out of order: gaps are set to the fill byte, and the lowest
+/// record address is the image origin. Automatic detection takes a text
+/// format only if the first line is a valid record.
+///
+/// Intel HEX records: 00 data, 01 end of file, 02 extended segment address,
+/// 04 extended linear address (03 and 05 start addresses are ignored).
+/// S-records: S1, S2, S3 data; S7, S8, S9 end (S0 header, S5 and S6 counts
+/// are ignored).
+class ImageLoader
+{
+public:
+    enum Format
+    {
+        Auto,
+        Binary,
+        IntelHex,
+        SRecord
+    };
+
+    ImageLoader();
+    ~ImageLoader();
+
+    void SetFormat(Format format) { m_format = format; };
+    void SetFillByte(uint8_t fill) { m_fill = fill; };
+
+    bool Load(const std::string &filename, std::vector<uint8_t> &image);
+    Format LoadedFormat() const { return m_loadedFormat; };
+    size_t Origin() const { return m_base; };
+
+    static bool ParseFormat(const std::string &name, Format &format);
+    static const char *FormatName(Format format);
+
+    // Largest span of record addresses
+    static constexpr size_t MaxImageSpan = 0x1000000;
+
+private:
+    Format Detect(std::istream &inStream);
+    const char *RecordError(const std::string &line, Format format);
+    bool LoadRecords(std::istream &inStream, std::vector<uint8_t> &image);
+    bool IntelHexRecord(const std::string &line);
+    bool SRecordRecord(const std::string &line);
+    bool DecodeBytes(const std::string &line, size_t first);
+    bool Store(size_t address, const uint8_t *pData, size_t size);
+    bool Error(const std::string &message) const;
+
+private:
+    Format m_format;
+    Format m_loadedFormat;
+    uint8_t m_fill;
+
+    // Loading state
+    std::string m_filename;
+    size_t m_lineNumber;
+    size_t m_base;  // address of image[0]
+    size_t m_top;  // end of the highest record
+    bool m_empty;
+    size_t m_upperAddress;  // Intel HEX segment or linear address
+    bool m_endRecord;
+    std::vector<uint8_t> m_record;  // bytes of the current record
+
+    // Data records in file order: image address, and data in m_data
+    struct Segment
+    {
+        size_t address;
+        size_t offset;
+        size_t size;
+    };
+    std::vector<Segment> m_segments;
+    std::vector<uint8_t> m_data;
+
+    // Hexadecimal digit values, -1 if not a digit
+    int8_t m_hexValue[256];
+};
@@ -21,8 +21,22 @@
 #include <iostream>
 #include <fstream>
 #include <getopt.h>
+#include <memory>
+#include <algorithm>  // min, max
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <map>
 
 #include "npd.h"
+#include "datasink.h"
+#include "loader.h"
+#include "interleave.h"
+#include "classifier.h"
+#include "symboldb.h"
+#include "checksum.h"
+#include "archive.h"
 
 // App version
 const std::string version = "1.0";
@@ -30,6 +44,23 @@ const std::string version = "1.0";
 const std::string lstExtension(".lst");
 // Ouput assembly file name extension
 const std::string asmExtension(".asm");
+// Output JSON Lines file name extension
+const std::string jsonlExtension(".jsonl");
+// Output binary file name extension
+const std::string binExtension(".npdb");
+// Listing index file name extension, appended to the listing file name
+const std::string indexExtension(".idx");
+// Compiled symbol database file name extension
+const std::string symbolExtension(".npsym");
+
+/// @brief Output file: format, numeric mode, comment character, and name
+struct OutputSpec
+{
+    std::string format;  // "lst", "asm", "jsonl", or "bin"
+    bool hexMode;
+    char commentChar;
+    std::string filename;
+};
 
 void showVersion()
 {
@@ -46,7 +77,11 @@ void showVersion()
 void showHelp()
 {
 	std::cout << "Usage: npd [OPTION]... FILE [-o OUTFILE]\n";
-	std::cout << "Disassemble a binary FILE into HP Nanoprocessor mnemonics.\n\n";
+	std::cout << "       npd [OPTION]... --interleave MODE FILE FILE... [-o OUTFILE]\n";
+	std::cout << "       npd [OPTION]... --search-order FILE...\n";
+	std::cout << "       npd [OPTION]... --archive ARCHIVE FILE...\n";
+	std::cout << "       npd --extract ARCHIVE [NAME]... [-o OUTFILE]\n";
+	std::cout << "Disassemble a binary, Intel HEX, or S-record FILE into HP Nanoprocessor mnemonics.\n\n";
 	std::cout << "OPTION\n";
 	std::cout << "  -h            Output this help text and exit.\n";
 	std::cout << "  -v            Output version and license information, and exit.\n";
@@ -54,7 +89,49 @@ void showHelp()
 	std::cout << "  -f            Overwrite an existing output file without warning.\n";
 	std::cout << "  -a            .asm output file (excludes addresses and opcodes).\n";
 	std::cout << "  -x            Use hexadecimals. The default is octal.\n";
-	std::cout << "  -c            Use '*' in comments. The default is ';'.\n\n";
+	std::cout << "  -c            Use '*' in comments. The default is ';'.\n";
+	std::cout << "  -s SIGFILE    Name known routines using a signature database.\n";
+	std::cout << "  -g SIGFILE    Append signatures of all labelled routines to SIGFILE.\n";
+	std::cout << "  -i RULEFILE   Comment instruction idioms described in RULEFILE.\n";
+	std::cout << "  -m MAPFILE    List the data regions of MAPFILE as data directives.\n";
+	std::cout << "  -u            Comment register and device usage of each subroutine.\n";
+	std::cout << "  -j JSONFILE   Write register and device usage of each subroutine as JSON.\n";
+	std::cout << "  -O SPEC       Also write output SPEC: FORMAT[/FLAGS][:OUTFILE]. Repeatable.\n";
+	std::cout << "                FORMAT is lst, asm, jsonl, or bin. FLAGS: x hexadecimal, o octal,\n";
+	std::cout << "                c '*' comments, s ';' comments. i.e. -O asm/xc:rom_hex.asm\n";
+	std::cout << "  -T            Write each output file on its own thread.\n";
+	std::cout << "  --origin ADDR Address of the first FILE byte. The default is 0, or the\n";
+	std::cout << "                lowest record address of Intel HEX and S-record files.\n";
+	std::cout << "  --start ADDR  First address to disassemble. The default is the origin.\n";
+	std::cout << "  --end ADDR    Stop before ADDR. The default is the end of the 2K bank of the start.\n";
+	std::cout << "                ADDR is decimal, 0x hexadecimal, or 0 octal. i.e. --start 0x1A00\n";
+	std::cout << "  --format FMT  Input FILE format: auto, bin, ihex, or srec. The default is auto.\n";
+	std::cout << "  --fill BYTE   Value of the addresses missing in Intel HEX and S-record files.\n";
+	std::cout << "                The default is 0xFF.\n";
+	std::cout << "  --interleave MODE  Merge split PROM dumps. MODE is nibble (first FILE\n";
+	std::cout << "                holds the high nibbles) or byte (FILE k holds bytes k, k+N...).\n";
+	std::cout << "  --bit-order LIST  Source data bits of image bits 7 to 0. i.e. 0,1,2,3,4,5,6,7\n";
+	std::cout << "  --address-order LIST  Source address lines of image lines An to A0.\n";
+	std::cout << "  --search-order  Rank the FILE orders and, without --bit-order, the data bit\n";
+	std::cout << "                orders by checksum matches and classifier score. No disassembly.\n";
+	std::cout << "  --suggest-map MAPFILE  Write the data regions suggested by the classifier.\n";
+	std::cout << "  --auto-data   List the suggested data regions as data. MAPFILE regions win.\n";
+	std::cout << "  --no-classify Skip the code and data classifier.\n";
+	std::cout << "  --index       Write an index of the address and label lines of OUTFILE\n";
+	std::cout << "                to OUTFILE.idx.\n";
+	std::cout << "  --symbols SYMFILE  Name and comment addresses using a symbol database,\n";
+	std::cout << "                compiled or text.\n";
+	std::cout << "  --image NAME  Image name in SYMFILE. The default is the FILE name.\n";
+	std::cout << "  --compile-symbols  Compile the symbol text FILE to OUTFILE (FILE.npsym).\n";
+	std::cout << "  --checksum SPEC  Verify a checksum: ALGORITHM[/FLAGS][@LOCATION][:START-END].\n";
+	std::cout << "                ALGORITHM is sum8, sum16, xor8, crc16, or crc32. Repeatable.\n";
+	std::cout << "                FLAGS: c complemented, n negated, l low byte first, b high byte first.\n";
+	std::cout << "                i.e. --checksum sum8/n@0x7FF:0-0x7FE\n";
+	std::cout << "  --one-pass    Decode and render each instruction once, back-patching labels.\n";
+	std::cout << "  --benchmark   Time two-pass and one-pass rendering, and compare the outputs.\n";
+	std::cout << "  --archive ARCHIVE  Write the listings of all FILEs into ARCHIVE, one worker\n";
+	std::cout << "                per CPU. Listings are named FILE.lst (.asm).\n";
+	std::cout << "  --extract     Extract the NAME listings of ARCHIVE, all of them if no NAME.\n\n";
 }
 
 void showUsage()
@@ -62,6 +139,513 @@ void showUsage()
 	std::cerr << "Usage: npd 'binary_file'\n";
 }
 
+/// @brief Input file name with a new extension
+std::string replaceExtension(const std::string &filename, const std::string &extension)
+{
+    // remove original extension
+    size_t lastdot = filename.find_last_of(".");
+    if (lastdot == std::string::npos)
+    {
+        return filename + extension;
+    }
+    return filename.substr(0, lastdot) + extension;
+}
+
+/// @brief Parse an address option: decimal, 0x hexadecimal, or 0 octal
+/// @return false if invalid
+bool parseAddress(const char *text, size_t maximum, size_t &address)
+{
+    char *end;
+    unsigned long value = strtoul(text, &end, 0);
+    if ((*text == '\0') || (*end != '\0') || (value > maximum))
+    {
+        return false;
+    }
+    address = value;
+    return true;
+}
+
+/// @brief Parse an output specification: FORMAT[/FLAGS][:OUTFILE]
+/// @return false if invalid
+bool parseOutputSpec(const std::string &text, OutputSpec &spec)
+{
+    size_t colon = text.find(':');
+    std::string format = text.substr(0, colon);
+    if (colon != std::string::npos)
+    {
+        spec.filename = text.substr(colon + 1);
+    }
+
+    size_t slash = format.find('/');
+    if (slash != std::string::npos)
+    {
+        std::string flags = format.substr(slash + 1);
+        format.erase(slash);
+        for (size_t i = 0; i < flags.size(); i++)
+        {
+            switch (flags[i])
+            {
+                case 'x': spec.hexMode = true; break;
+                case 'o': spec.hexMode = false; break;
+                case 'c': spec.commentChar = '*'; break;
+                case 's': spec.commentChar = ';'; break;
+                default: return false;
+            }
+        }
+    }
+
+    if ((format != "lst") && (format != "asm") && (format != "jsonl") && (format != "bin"))
+    {
+        return false;
+    }
+    spec.format = format;
+    return true;
+}
+
+/// @brief Default file name extension of an output format
+std::string formatExtension(const std::string &format)
+{
+    if (format == "asm")
+    {
+        return asmExtension;
+    }
+    if (format == "jsonl")
+    {
+        return jsonlExtension;
+    }
+    if (format == "bin")
+    {
+        return binExtension;
+    }
+    return lstExtension;
+}
+
+/// @brief Create the output sink of a format
+OutputSink *createSink(const OutputSpec &spec, std::ostream &outStream)
+{
+    if (spec.format == "jsonl")
+    {
+        return new JsonLinesSink(spec.hexMode, outStream);
+    }
+    if (spec.format == "bin")
+    {
+        return new BinarySink(spec.hexMode, outStream);
+    }
+    return new TextSink(spec.format == "asm", spec.hexMode, spec.commentChar, outStream);
+}
+
+/// @brief Time two-pass and one-pass rendering of the window, and compare them
+/// @return false if the outputs differ
+bool benchmark(const std::vector<uint8_t> &image, const OutputSpec &spec, size_t origin, size_t start, size_t end,
+               const SignatureDb &signatures, const IdiomMatcher &idioms, const RegionMap &regions,
+               const SymbolDb &symbols)
+{
+    static const int Runs = 20;
+    static const char *modeNames[2] = { "Two-pass", "One-pass" };
+    std::string outputs[2];
+    for (int mode = 0; mode < 2; mode++)
+    {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        bool usedOnePass = false;
+        for (int run = 0; run < Runs; run++)
+        {
+            std::ostringstream text;
+            TextSink sink(spec.format == "asm", spec.hexMode, spec.commentChar, text);
+            NpDisassembler disasm(spec.hexMode, version);
+            disasm.AddSink(&sink);
+            disasm.SetOrigin((uint16_t)origin);
+            disasm.SetSignatures(&signatures);
+            disasm.SetIdioms(&idioms);
+            disasm.SetRegions(&regions);
+            disasm.SetSymbols(&symbols);
+            disasm.SetOnePass(mode == 1);
+            disasm.render(&image, start, end);
+            outputs[mode] = text.str();
+            usedOnePass = disasm.isOnePassUsed();
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+        std::cout << modeNames[mode] << ": " << elapsed.count() / Runs << " ms per run"
+                  << (((mode == 1) && !usedOnePass) ? " (used two passes)" : "") << std::endl;
+    }
+
+    bool identical = (outputs[0] == outputs[1]);
+    std::cout << "Outputs " << (identical ? "identical" : "differ") << " (" << outputs[0].size() << " bytes)\n";
+    return identical;
+}
+
+/// @brief Ask before overwriting an existing file
+/// @return false if the user refuses
+bool confirmOverwrite(const std::string &filename, bool overwriteOutput)
+{
+    std::ifstream testFileStream(filename);
+    bool fileExist = testFileStream.is_open();
+    testFileStream.close();
+    if (fileExist && !overwriteOutput)
+    {
+        char answer;
+        std::cout << "File: " << filename << "\nAlready exist. Overwrite it? [y/n]";
+        std::cin >> answer;
+        if (toupper(answer) != 'Y')
+        {
+            return false;
+        }		
+    }
+    return true;
+}
+
+/// @brief Settings of the per-image pipeline, shared by single-file and archive runs
+struct ImageSettings
+{
+    ImageLoader loader;
+    const ImageMerger *pMerger;
+    size_t origin;
+    bool originSet;
+    size_t start;
+    size_t end;
+    bool hexMode;
+    const ChecksumVerifier *pChecksums;
+    const SignatureDb *pSignatures;
+    const IdiomMatcher *pIdioms;
+    const RegionMap *pRegions;
+    bool classify;
+    bool autoData;
+    bool usage;
+    bool onePass;
+};
+
+/// @brief Image loaded, verified, and classified, ready to disassemble
+struct PreparedImage
+{
+    std::vector<uint8_t> image;
+    size_t origin;
+    std::vector<std::string> checksumReport;
+    bool classified;
+    RegionMap suggestions;
+    RegionMap regions;
+};
+
+/// @brief Load or merge the image, verify it, check the window, and suggest data regions
+/// @return false on errors, described in error unless the loader or merger reported them
+bool prepareImage(const std::vector<std::string> &filenames, const ImageSettings &settings,
+                  PreparedImage &prepared, std::string &error)
+{
+    // Read input files. Record addresses set the origin
+    ImageLoader loader = settings.loader;
+    prepared.origin = settings.origin;
+    if (!loader.Load(filenames[0], prepared.image))
+    {
+        return false;
+    }
+    if ((settings.pMerger != NULL) && settings.pMerger->isActive())
+    {
+        std::vector<std::vector<uint8_t> > dumps(1, prepared.image);
+        for (size_t i = 1; i < filenames.size(); i++)
+        {
+            dumps.push_back(std::vector<uint8_t>());
+            if (!loader.Load(filenames[i], dumps.back()))
+            {
+                return false;
+            }
+        }
+        if (!settings.pMerger->Merge(dumps, prepared.image))
+        {
+            return false;
+        }
+    }
+    else if ((loader.LoadedFormat() != ImageLoader::Binary) && !settings.originSet)
+    {
+        prepared.origin = loader.Origin();
+        if (prepared.origin >= NpDisassembler::MaxImageSize)
+        {
+            error = "Record addresses out of the 64K address space";
+            return false;
+        }
+    }
+    size_t origin = prepared.origin;
+
+    // Verify the image before decoding it
+    if (!settings.pChecksums->empty())
+    {
+        Decoder decoder;
+        if (settings.hexMode)
+        {
+            decoder.SetHexMode();
+        }
+        settings.pChecksums->Verify(prepared.image, origin, decoder, prepared.checksumReport);
+    }
+
+    // Check the disassembly window
+    size_t start = settings.start;
+    size_t end = settings.end;
+    size_t imageEnd = std::min(origin + prepared.image.size(), NpDisassembler::MaxImageSize);
+    if ((start != 0) && ((start < origin) || (start >= imageEnd)))
+    {
+        error = "Start address out of the image";
+        return false;
+    }
+    if ((end != 0) && (end <= std::max(start, origin)))
+    {
+        error = "End address before the start address";
+        return false;
+    }
+    bool windowed = (origin != 0) || (start != 0) || (end != 0);
+    if (windowed && settings.usage &&
+        ((origin != 0) || (end > NpDisassembler::MaxRomSize) || (start >= NpDisassembler::MaxRomSize)))
+    {
+        error = "Register and device usage needs a window in the first 2K, at origin 0";
+        return false;
+    }
+
+    // Suggest data regions. MAPFILE regions take precedence
+    prepared.regions = *settings.pRegions;
+    prepared.classified = settings.classify || settings.autoData;
+    if (prepared.classified)
+    {
+        CodeClassifier classifier;
+        classifier.Classify(prepared.image, origin, prepared.suggestions);
+        for (size_t i = 0; settings.autoData && (i < prepared.suggestions.size()); i++)
+        {
+            prepared.regions.Add(prepared.suggestions.at(i));
+        }
+    }
+    return true;
+}
+
+/// @brief Apply the settings of a prepared image to a disassembler
+void setupDisassembler(NpDisassembler &disasm, const PreparedImage &prepared, const ImageSettings &settings,
+                       const SymbolDb &symbols)
+{
+    disasm.SetOrigin((uint16_t)prepared.origin);
+    disasm.SetWindow(settings.start, settings.end);
+    disasm.SetSignatures(settings.pSignatures);
+    disasm.SetIdioms(settings.pIdioms);
+    disasm.SetRegions(&prepared.regions);
+    disasm.SetSymbols(&symbols);
+    for (size_t i = 0; i < prepared.checksumReport.size(); i++)
+    {
+        disasm.AddHeaderComment(prepared.checksumReport[i]);
+    }
+    disasm.SetOnePass(settings.onePass);
+}
+
+/// @brief Disassemble one file of an archive into memory
+/// @return Error message, empty on success
+std::string batchListing(const std::string &filename, const OutputSpec &spec, const ImageSettings &settings,
+                         SymbolDb &symbols, std::string &listing)
+{
+    PreparedImage prepared;
+    std::string error;
+    if (!prepareImage(std::vector<std::string>(1, filename), settings, prepared, error))
+    {
+        return error.empty() ? "Read error" : error;
+    }
+    symbols.SetImage(filename.substr(filename.find_last_of("/\\") + 1));
+
+    std::ostringstream text;
+    std::unique_ptr<OutputSink> sink(createSink(spec, text));
+    NpDisassembler disasm(spec.hexMode, version);
+    disasm.AddSink(sink.get());
+    setupDisassembler(disasm, prepared, settings, symbols);
+    UsageAnalysis usage;
+    if (settings.usage)
+    {
+        disasm.SetUsageAnalysis(&usage, true);
+    }
+    disasm.disassemble(&prepared.image, filename);
+    listing = text.str();
+    return "";
+}
+
+/// @brief Write the listings of a list of files into one archive, one worker per CPU
+/// Each worker loads its own symbol database: mapped files are shared by the OS
+int archiveListings(const std::vector<std::string> &filenames, const std::string &archiveFilename,
+                    const OutputSpec &spec, const ImageSettings &settings, const std::string &symbolFilename,
+                    bool overwriteOutput)
+{
+    // Listings are named after the input files, which must not collide
+    std::vector<std::string> names(filenames.size());
+    std::map<std::string, size_t> nameIndex;
+    for (size_t i = 0; i < filenames.size(); i++)
+    {
+        names[i] = filenames[i].substr(filenames[i].find_last_of("/\\") + 1);
+        names[i] = replaceExtension(names[i], formatExtension(spec.format));
+        std::map<std::string, size_t>::const_iterator found = nameIndex.find(names[i]);
+        if (found != nameIndex.end())
+        {
+            std::cerr << "Duplicate listing name " << names[i] << " for " << filenames[found->second]
+                      << " and " << filenames[i] << std::endl;
+            return -1;
+        }
+        nameIndex[names[i]] = i;
+    }
+
+    if (!confirmOverwrite(archiveFilename, overwriteOutput))
+    {
+        std::cerr << "Halted.\n";
+        return -1;
+    }
+    ListingArchive archive;
+    if (!archive.Create(archiveFilename, filenames.size()))
+    {
+        return -1;
+    }
+
+    std::vector<std::string> results(filenames.size());
+    std::atomic<size_t> next(0);
+    std::atomic<uint64_t> listingBytes(0);
+
+    unsigned workers = std::thread::hardware_concurrency();
+    workers = std::max(1u, std::min(workers, (unsigned)filenames.size()));
+    std::vector<std::thread> threads;
+    for (unsigned w = 0; w < workers; w++)
+    {
+        threads.push_back(std::thread([&]() {
+            SymbolDb symbols;
+            bool symbolsLoaded = symbolFilename.empty() || symbols.Load(symbolFilename);
+            size_t i;
+            while ((i = next++) < filenames.size())
+            {
+                if (!symbolsLoaded)
+                {
+                    results[i] = "Symbol database error";
+                    continue;
+                }
+                std::string listing;
+                results[i] = batchListing(filenames[i], spec, settings, symbols, listing);
+                if (!results[i].empty())
+                {
+                    continue;
+                }
+                if (!archive.Write(i, names[i], listing))
+                {
+                    results[i] = "Archive write error";
+                    continue;
+                }
+                listingBytes += listing.size();
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        threads[t].join();
+    }
+
+    size_t failed = 0;
+    for (size_t i = 0; i < filenames.size(); i++)
+    {
+        if (!results[i].empty())
+        {
+            std::cerr << "Not archived " << filenames[i] << ": " << results[i] << std::endl;
+            failed++;
+        }
+    }
+    if (!archive.Close())
+    {
+        return -1;
+    }
+    std::cout << "Archive file: " << archiveFilename << " (" << filenames.size() - failed << " listings, "
+              << listingBytes << " bytes)" << std::endl;
+    return (failed == 0) ? 0 : -1;
+}
+
+/// @brief Print the most likely dump and data bit orders of split PROM dumps
+/// @return false on errors
+bool searchOrders(const std::vector<std::string> &filenames, ImageLoader &loader, const ImageMerger &merger,
+                  size_t origin, const ChecksumVerifier &checksums)
+{
+    static const size_t Shown = 10;
+    std::vector<std::vector<uint8_t> > dumps(filenames.size());
+    for (size_t i = 0; i < filenames.size(); i++)
+    {
+        if (!loader.Load(filenames[i], dumps[i]))
+        {
+            return false;
+        }
+    }
+    CodeClassifier classifier;
+    std::vector<ImageMerger::Candidate> ranking;
+    if (!merger.SearchOrders(dumps, origin, classifier, checksums, ranking))
+    {
+        return false;
+    }
+
+    std::cout << "Candidate orders: " << ranking.size() << std::endl;
+    for (size_t i = 0; (i < ranking.size()) && (i < Shown); i++)
+    {
+        const ImageMerger::Candidate &candidate = ranking[i];
+        std::cout << i + 1 << ": score " << candidate.score << (candidate.verified ? ", checksums match" : "")
+                  << "  --bit-order ";
+        for (size_t b = 0; b < candidate.bits.size(); b++)
+        {
+            std::cout << (b ? "," : "") << candidate.bits[b];
+        }
+        for (size_t f = 0; f < candidate.files.size(); f++)
+        {
+            std::cout << " " << filenames[candidate.files[f]];
+        }
+        std::cout << std::endl;
+    }
+    return true;
+}
+
+/// @brief Extract listings of an archive to files named after them. All of them if no names
+/// @return false on errors
+bool extractListings(const std::string &archiveFilename, const std::vector<std::string> &names,
+                     const std::string &outputFilename, bool overwriteOutput)
+{
+    ListingArchive archive;
+    if (!archive.Open(archiveFilename))
+    {
+        return false;
+    }
+    std::vector<const ListingArchive::Entry *> entries;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        entries.push_back(archive.Find(names[i]));
+        if (entries.back() == NULL)
+        {
+            std::cerr << "No listing " << names[i] << " in " << archiveFilename << std::endl;
+            return false;
+        }
+    }
+    for (size_t i = 0; names.empty() && (i < archive.size()); i++)
+    {
+        entries.push_back(&archive.at(i));
+    }
+    if (!outputFilename.empty() && (entries.size() != 1))
+    {
+        std::cerr << "-o needs a single listing name\n";
+        return false;
+    }
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        std::string data;
+        if (!archive.Read(*entries[i], data))
+        {
+            return false;
+        }
+        // Never write out of the current directory
+        const std::string &name = entries[i]->name;
+        std::string filename = outputFilename.empty() ? name.substr(name.find_last_of("/\\") + 1) : outputFilename;
+        if (!confirmOverwrite(filename, overwriteOutput))
+        {
+            std::cerr << "Halted.\n";
+            return false;
+        }
+        std::ofstream outFileStream(filename, std::ios::out | std::ios::binary);
+        outFileStream.write(data.data(), data.size());
+        outFileStream.close();
+        if (!outFileStream)
+        {
+            std::cerr << "Error writing file " << filename << std::endl;
+            return false;
+        }
+        std::cout << "Output file: " << filename << std::endl;
+    }
+    return true;
+}
+
 int main(int argc, char* argv[])
 {
     if(argc < 2)
@@ -77,9 +661,70 @@ int main(int argc, char* argv[])
     bool asmMode = false;
     bool hexMode = false;
     char commentChar = ';';
+    std::string signatureFilename;
+    std::string newSignatureFilename;
+    std::string idiomFilename;
+    std::string mapFilename;
+    bool classify = true;
+    bool autoData = false;
+    std::string suggestFilename;
+    bool writeIndex = false;
+    std::string symbolFilename;
+    std::string imageName;
+    bool compileSymbols = false;
+    ChecksumVerifier checksums;
+    bool onePass = false;
+    bool benchmarkPasses = false;
+    std::string archiveFilename;
+    bool extract = false;
+    bool searchOrder = false;
+    bool usageComments = false;
+    std::string usageFilename;
+    std::vector<std::string> outputSpecs;
+    bool threadedOutput = false;
+    size_t origin = 0;
+    bool originSet = false;
+    size_t start = 0;
+    size_t end = 0;
+    ImageLoader loader;
+    ImageLoader::Format inputFormat;
+    size_t fill;
+    ImageMerger merger;
+
+    // Long only options
+    enum { OptionOrigin = 256, OptionStart, OptionEnd, OptionFormat, OptionFill,
+           OptionInterleave, OptionBitOrder, OptionAddressOrder,
+           OptionAutoData, OptionSuggestMap, OptionNoClassify, OptionIndex,
+           OptionSymbols, OptionImage, OptionCompileSymbols, OptionChecksum,
+           OptionOnePass, OptionBenchmark, OptionArchive, OptionExtract, OptionSearchOrder };
+    static const struct option longOptions[] =
+    {
+        {"origin", required_argument, NULL, OptionOrigin},
+        {"start", required_argument, NULL, OptionStart},
+        {"end", required_argument, NULL, OptionEnd},
+        {"format", required_argument, NULL, OptionFormat},
+        {"fill", required_argument, NULL, OptionFill},
+        {"interleave", required_argument, NULL, OptionInterleave},
+        {"bit-order", required_argument, NULL, OptionBitOrder},
+        {"address-order", required_argument, NULL, OptionAddressOrder},
+        {"search-order", no_argument, NULL, OptionSearchOrder},
+        {"auto-data", no_argument, NULL, OptionAutoData},
+        {"suggest-map", required_argument, NULL, OptionSuggestMap},
+        {"no-classify", no_argument, NULL, OptionNoClassify},
+        {"index", no_argument, NULL, OptionIndex},
+        {"symbols", required_argument, NULL, OptionSymbols},
+        {"image", required_argument, NULL, OptionImage},
+        {"compile-symbols", no_argument, NULL, OptionCompileSymbols},
+        {"checksum", required_argument, NULL, OptionChecksum},
+        {"one-pass", no_argument, NULL, OptionOnePass},
+        {"benchmark", no_argument, NULL, OptionBenchmark},
+        {"archive", required_argument, NULL, OptionArchive},
+        {"extract", no_argument, NULL, OptionExtract},
+        {NULL, 0, NULL, 0}
+    };
     
     int opt;
-    while ((opt = getopt(argc, argv, ":o:hvfaxc")) != -1) 
+    while ((opt = getopt_long(argc, argv, ":o:hvfaxcs:g:i:m:uj:O:T", longOptions, NULL)) != -1) 
     {
         switch (opt) 
         {
@@ -106,12 +751,126 @@ int main(int argc, char* argv[])
             case 'c':  // use asterisk for comments (original HP documentation)
                 commentChar = '*';
                 break;
+            case 's':  // known routine signatures database
+                signatureFilename = optarg;
+                break;
+            case 'g':  // generate signatures
+                newSignatureFilename = optarg;
+                break;
+            case 'i':  // instruction idiom rules
+                idiomFilename = optarg;
+                break;
+            case 'm':  // code and data region map
+                mapFilename = optarg;
+                break;
+            case 'u':  // register and device usage comments
+                usageComments = true;
+                break;
+            case 'j':  // register and device usage JSON file
+                usageFilename = optarg;
+                break;
+            case 'O':  // additional output file
+                outputSpecs.push_back(optarg);
+                break;
+            case 'T':  // one thread per output file
+                threadedOutput = true;
+                break;
+            case OptionOrigin:  // address of the first input byte
+            case OptionStart:  // disassembly window
+            case OptionEnd:
+            {
+                size_t &address = (opt == OptionOrigin) ? origin : ((opt == OptionStart) ? start : end);
+                size_t maximum = NpDisassembler::MaxImageSize - ((opt == OptionEnd) ? 0 : 1);
+                if (!parseAddress(optarg, maximum, address))
+                {
+                    std::cerr << "Invalid address '" << optarg << "'\n";
+                    return -1;
+                }
+                originSet = originSet || (opt == OptionOrigin);
+                break;
+            }
+            case OptionFormat:  // input file format
+                if (!ImageLoader::ParseFormat(optarg, inputFormat))
+                {
+                    std::cerr << "Invalid input format '" << optarg << "'\n";
+                    return -1;
+                }
+                loader.SetFormat(inputFormat);
+                break;
+            case OptionFill:  // value of missing addresses
+                if (!parseAddress(optarg, 0xFF, fill))
+                {
+                    std::cerr << "Invalid fill byte '" << optarg << "'\n";
+                    return -1;
+                }
+                loader.SetFillByte((uint8_t)fill);
+                break;
+            case OptionInterleave:  // split PROM dumps
+                if (!merger.SetMode(optarg))
+                {
+                    return -1;
+                }
+                break;
+            case OptionBitOrder:  // data line permutation
+                if (!merger.SetBitOrder(optarg))
+                {
+                    return -1;
+                }
+                break;
+            case OptionAddressOrder:  // address line permutation
+                if (!merger.SetAddressOrder(optarg))
+                {
+                    return -1;
+                }
+                break;
+            case OptionSearchOrder:  // rank candidate dump and bit orders
+                searchOrder = true;
+                break;
+            case OptionAutoData:  // list suggested data regions as data
+                autoData = true;
+                break;
+            case OptionSuggestMap:  // write suggested data regions
+                suggestFilename = optarg;
+                break;
+            case OptionNoClassify:  // skip the code and data classifier
+                classify = false;
+                break;
+            case OptionIndex:  // listing index sidecar file
+                writeIndex = true;
+                break;
+            case OptionSymbols:  // address names and comments
+                symbolFilename = optarg;
+                break;
+            case OptionImage:  // image name in the symbol database
+                imageName = optarg;
+                break;
+            case OptionCompileSymbols:  // compile a symbol text file
+                compileSymbols = true;
+                break;
+            case OptionChecksum:  // verify a stored checksum
+                if (!checksums.AddSpec(optarg))
+                {
+                    return -1;
+                }
+                break;
+            case OptionOnePass:  // decode and render in one pass
+                onePass = true;
+                break;
+            case OptionBenchmark:  // compare two-pass and one-pass times
+                benchmarkPasses = true;
+                break;
+            case OptionArchive:  // write all listings into one archive
+                archiveFilename = optarg;
+                break;
+            case OptionExtract:  // extract listings of an archive
+                extract = true;
+                break;
             case '?':  // ERROR: Invalid option
                 std::cerr << "Unknown option: -" << char(optopt) << std::endl;
                 return -1;
                 break;
-            case ':':  // ERROR: No output file name
-                std::cerr << "Missing output file name (option -" << char(optopt) << ").\n";
+            case ':':  // ERROR: No option argument
+                std::cerr << "Missing file name (option -" << char(optopt) << ").\n";
                 return -1;
                 break;
             default:  // (shall not reach here.. but..)
@@ -127,81 +886,291 @@ int main(int argc, char* argv[])
 		return -1;
     }
     
-    // Define input file name
+    // Define input file name. Several files only to be merged or archived
 	inputFilename = argv[optind++];
 	
 	// Error on any extra non-option arguments
-	while (optind < argc)
+	if (!merger.isActive() && archiveFilename.empty() && !extract && !searchOrder && (optind < argc))
 	{
 		std::cerr << "Invalid argument " << argv[optind++] << std::endl;
 		return -1;
 	}
 
-    // Read input binary file
-    std::ifstream inFileStream(inputFilename.c_str(), std::ios::in | std::ios::binary);
-    if (!inFileStream.is_open()) 
+    // Compile a symbol database, no disassembly
+    if (compileSymbols)
+    {
+        SymbolDb symbols;
+        if (!symbols.Import(inputFilename))
+        {
+            return -1;
+        }
+        if (outputFilename.empty())
+        {
+            outputFilename = replaceExtension(inputFilename, symbolExtension);
+        }
+        if (!confirmOverwrite(outputFilename, overwriteOutput))
+        {
+            std::cerr << "Halted.\n";
+            return -1;
+        }
+        if (!symbols.Save(outputFilename))
+        {
+            return -1;
+        }
+        std::cout << "Output file: " << outputFilename << " (" << symbols.size() << " symbols, "
+                  << symbols.ImageCount() << " images)" << std::endl;
+        return 0;
+    }
+
+    std::vector<std::string> inputFilenames(1, inputFilename);
+    inputFilenames.insert(inputFilenames.end(), argv + optind, argv + argc);
+
+    // Extract listings of an archive, no disassembly
+    if (extract)
+    {
+        std::vector<std::string> names(inputFilenames.begin() + 1, inputFilenames.end());
+        return extractListings(inputFilename, names, outputFilename, overwriteOutput) ? 0 : -1;
+    }
+
+    // Rank candidate orders of split dumps, no disassembly
+    if (searchOrder)
+    {
+        return searchOrders(inputFilenames, loader, merger, origin, checksums) ? 0 : -1;
+    }
+
+    // Load known routine signatures
+    SignatureDb signatures;
+    if (!signatureFilename.empty() && !signatures.Load(signatureFilename))
     {
-		std::cerr << "Error reading file '" << inputFilename << "'\n";
+		std::cerr << "Error reading file '" << signatureFilename << "'\n";
 		return -1;
-	}
-	std::vector<uint8_t> binaryInput(std::istreambuf_iterator<char>(inFileStream), {});
-    inFileStream.close();
+    }
 
-    // Define output file
-    if (outputFilename.empty())
+    // Compile instruction idiom rules
+    IdiomMatcher idioms;
+    if (!idiomFilename.empty())
     {
-        // remove original extension
-        size_t lastdot = inputFilename.find_last_of(".");
-        if (lastdot == std::string::npos)
+        Decoder decoder;
+        if (!idioms.Load(idiomFilename, decoder))
         {
-            outputFilename = inputFilename;
+            return -1;
         }
-        else
+    }
+
+    // Load code and data regions
+    RegionMap regions;
+    if (!mapFilename.empty() && !regions.Load(mapFilename))
+    {
+        return -1;
+    }
+
+    // Per-image pipeline, shared by single-file and archive runs
+    ImageSettings settings;
+    settings.loader = loader;
+    settings.pMerger = &merger;
+    settings.origin = origin;
+    settings.originSet = originSet;
+    settings.start = start;
+    settings.end = end;
+    settings.hexMode = hexMode;
+    settings.pChecksums = &checksums;
+    settings.pSignatures = &signatures;
+    settings.pIdioms = &idioms;
+    settings.pRegions = &regions;
+    settings.classify = classify || !suggestFilename.empty();
+    settings.autoData = autoData;
+    settings.usage = usageComments || !usageFilename.empty();
+    // Signatures are collected in label list order: two passes only
+    settings.onePass = onePass && newSignatureFilename.empty();
+
+    // Archive the listings of all input files, no merge
+    if (!archiveFilename.empty())
+    {
+        if (!outputFilename.empty() || !outputSpecs.empty() || threadedOutput || !newSignatureFilename.empty() ||
+            !usageFilename.empty() || writeIndex || !suggestFilename.empty() || !imageName.empty() ||
+            merger.isActive() || benchmarkPasses)
+        {
+            std::cerr << "--archive not available with -o, -O, -T, -g, -j, --index, --suggest-map, --image, "
+                         "--interleave, or --benchmark\n";
+            return -1;
+        }
+        OutputSpec spec;
+        spec.format = asmMode ? "asm" : "lst";
+        spec.hexMode = hexMode;
+        spec.commentChar = commentChar;
+        return archiveListings(inputFilenames, archiveFilename, spec, settings, symbolFilename, overwriteOutput);
+    }
+
+    // Read, verify, and classify the image
+    PreparedImage prepared;
+    std::string error;
+    bool prepareOk = prepareImage(inputFilenames, settings, prepared, error);
+    for (size_t i = 0; i < prepared.checksumReport.size(); i++)
+    {
+        std::cout << prepared.checksumReport[i] << std::endl;
+    }
+    if (!prepareOk)
+    {
+        if (!error.empty())
         {
-            outputFilename =  inputFilename.substr(0, lastdot);
+            std::cerr << error << std::endl;
         }
+        return -1;
+    }
+    origin = prepared.origin;
+    // Default runs stay quiet unless there is something to suggest
+    if (prepared.classified && (autoData || !suggestFilename.empty() || (prepared.suggestions.size() != 0)))
+    {
+        std::cout << "Suggested data regions: " << prepared.suggestions.size() << std::endl;
+    }
+    if (!suggestFilename.empty() && !prepared.suggestions.Save(suggestFilename))
+    {
+        return -1;
+    }
 
-        // set new extension
-        if (asmMode)
+    // Load address names and comments. Images are keyed by file name
+    SymbolDb symbols;
+    if (!symbolFilename.empty())
+    {
+        if (!symbols.Load(symbolFilename))
         {
-            outputFilename += asmExtension;
+            return -1;
         }
-        else
+        if (imageName.empty())
         {
-            outputFilename += lstExtension;
-        }		
-	}
+            imageName = inputFilename.substr(inputFilename.find_last_of("/\\") + 1);
+        }
+        symbols.SetImage(imageName);
+    }
 
-    // Confirm overwrite output file
-    std::ifstream testFileStream(outputFilename);
-    bool fileExist = testFileStream.is_open();
-    testFileStream.close();
-    if (fileExist && !overwriteOutput)
+    // Define output files. The first one is set by -o, -a, -x, and -c
+    std::vector<OutputSpec> outputs(1);
+    outputs[0].format = asmMode ? "asm" : "lst";
+    outputs[0].hexMode = hexMode;
+    outputs[0].commentChar = commentChar;
+    outputs[0].filename = outputFilename;
+    for (size_t i = 0; i < outputSpecs.size(); i++)
     {
-        char answer;
-        testFileStream.close();
-        std::cout << "File: " << outputFilename << "\nAlready exist. Overwrite it? [y/n]";
-        std::cin >> answer;
-        if (toupper(answer) != 'Y')
+        OutputSpec spec = outputs[0];
+        spec.filename.erase();
+        if (!parseOutputSpec(outputSpecs[i], spec))
         {
-            std::cerr << "Halted.\n";
+            std::cerr << "Invalid output specification '" << outputSpecs[i] << "'\n";
             return -1;
-        }		
+        }
+        outputs.push_back(spec);
     }
-    
-    // Create output file
-    std::ofstream outFileStream(outputFilename);
-    if (!outFileStream.is_open())
+
+    // Create output files and their sinks
+    std::vector<std::unique_ptr<std::ofstream> > outFileStreams;
+    std::vector<std::unique_ptr<OutputSink> > sinks;
+    std::vector<std::unique_ptr<OutputSink> > threadedSinks;
+    NpDisassembler disasm(hexMode, version);
+    ListingIndex index;
+    for (size_t i = 0; i < outputs.size(); i++)
     {
-        std::cerr << "Error writing file " << outputFilename << std::endl;
-        return -1;
+        OutputSpec &spec = outputs[i];
+        if (spec.filename.empty())
+        {
+            spec.filename = replaceExtension(inputFilename, formatExtension(spec.format));
+        }
+
+        // Confirm overwrite output file
+        if (!confirmOverwrite(spec.filename, overwriteOutput))
+        {
+            std::cerr << "Halted.\n";
+            return -1;
+        }
+    
+        // Create output file. Index offsets count untranslated line ends
+        std::ios::openmode mode = std::ios::out;
+        if ((spec.format == "bin") || (writeIndex && (i == 0)))
+        {
+            mode |= std::ios::binary;
+        }
+        outFileStreams.emplace_back(new std::ofstream(spec.filename, mode));
+        if (!outFileStreams.back()->is_open())
+        {
+            std::cerr << "Error writing file " << spec.filename << std::endl;
+            return -1;
+        }
+
+        sinks.emplace_back(createSink(spec, *outFileStreams.back()));
+        if (writeIndex && (i == 0))
+        {
+            // The first output is always .lst or .asm text
+            static_cast<TextSink *>(sinks.back().get())->SetIndex(&index);
+        }
+        if (threadedOutput)
+        {
+            threadedSinks.emplace_back(new ThreadedSink(sinks.back().get()));
+            disasm.AddSink(threadedSinks.back().get());
+        }
+        else
+        {
+            disasm.AddSink(sinks.back().get());
+        }
     }
 
     // Disassemble
-    NpDisassembler disasm(asmMode, hexMode, commentChar, version, outFileStream);
-    disasm.disassemble(&binaryInput, inputFilename);
-    outFileStream.close();
-    std::cout << "Output file: " << outputFilename << std::endl;
+    setupDisassembler(disasm, prepared, settings, symbols);
+    UsageAnalysis usage;
+    if (settings.usage)
+    {
+        disasm.SetUsageAnalysis(&usage, usageComments);
+    }
+    disasm.disassemble(&prepared.image, inputFilename);
+    if (onePass && !disasm.isOnePassUsed())
+    {
+        std::cout << "One-pass mode not available with -s, -g, -u, -j, or data regions: used two passes\n";
+    }
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        outFileStreams[i]->close();
+        std::cout << "Output file: " << outputs[i].filename << std::endl;
+    }
+    if (writeIndex)
+    {
+        std::string indexFilename = outputs[0].filename + indexExtension;
+        if (!index.Save(indexFilename))
+        {
+            return -1;
+        }
+        std::cout << "Index file: " << indexFilename << " (" << index.size() << " addresses)" << std::endl;
+    }
+
+    // Save register and device usage
+    if (!usageFilename.empty())
+    {
+        std::ofstream usageFileStream(usageFilename);
+        if (!usageFileStream.is_open())
+        {
+            std::cerr << "Error writing file " << usageFilename << std::endl;
+            return -1;
+        }
+        usage.WriteJson(usageFileStream, inputFilename);
+        std::cout << "Usage file: " << usageFilename << std::endl;
+    }
+
+    // Save signatures of this binary
+    if (!newSignatureFilename.empty())
+    {
+        SignatureDb newSignatures;
+        disasm.CollectSignatures(newSignatures);
+        if (!newSignatures.Append(newSignatureFilename, inputFilename))
+        {
+            std::cerr << "Error writing file " << newSignatureFilename << std::endl;
+            return -1;
+        }
+        std::cout << "Signature file: " << newSignatureFilename
+                  << " (" << newSignatures.size() << " routines)" << std::endl;
+    }
+
+    if (benchmarkPasses && !benchmark(prepared.image, outputs[0], origin, start, end,
+                                      signatures, idioms, prepared.regions, symbols))
+    {
+        return -1;
+    }
 
     return 0;
 }
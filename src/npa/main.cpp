@@ -0,0 +1,302 @@
+/* npd project: npa/main.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <getopt.h>
+#include <thread>
+#include <atomic>
+
+#include "../npd.h"
+#include "../assembler.h"
+
+// App version
+const std::string version = "1.0";
+// Output binary file name extension
+const std::string binExtension(".bin");
+
+void showVersion()
+{
+	std::cout << "npa " << version << " - a Nanoprocessor assembler\n\n";
+	std::cout << "Copyright (C) 2023  Ricardo F. Lopes\n";
+	std::cout << "License GPLv3+: GNU GPL version 3 or later.\n";
+	std::cout << "This program comes with ABSOLUTELY NO WARRANTY.\n";
+	std::cout << "This is free software, and you are welcome to redistribute it\n";
+	std::cout << "under certain conditions; see file 'Copyright.txt' for details\n";
+	std::cout << "or visit <https://gnu.org/licenses/gpl.html>.\n\n";
+}
+
+/// Show help text
+void showHelp()
+{
+	std::cout << "Usage: npa [OPTION]... FILE [-o OUTFILE]\n";
+	std::cout << "       npa --verify [OPTION]... BINFILE...\n";
+	std::cout << "Assemble an 'npd -a' .asm FILE into a binary file.\n\n";
+	std::cout << "OPTION\n";
+	std::cout << "  -h            Output this help text and exit.\n";
+	std::cout << "  -v            Output version and license information, and exit.\n";
+	std::cout << "  -o OUTFILE    Set the output file name. The default is FILE.bin\n";
+	std::cout << "  -f            Overwrite an existing output file without warning.\n";
+	std::cout << "  -x            Use hexadecimals if FILE has no 'Mode:' header. The default is octal.\n";
+	std::cout << "  -y, --verify  Disassemble and reassemble each BINFILE and compare.\n\n";
+}
+
+void showUsage()
+{
+	std::cerr << "Usage: npa 'asm_file'\n";
+}
+
+/// @brief Disassemble a binary to .asm text, assemble it back and compare
+/// @return empty if identical, else the reason
+std::string verifyFile(const std::string &filename, bool hexMode)
+{
+    std::ifstream inFileStream(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!inFileStream.is_open())
+    {
+        return "can't read file";
+    }
+	std::vector<uint8_t> binary(std::istreambuf_iterator<char>(inFileStream), {});
+    if (binary.empty())
+    {
+        return "empty file";
+    }
+    if (binary.size() > NpDisassembler::MaxImageSize)
+    {
+        return "larger than the 64K address space";
+    }
+
+    // Disassemble
+    std::stringstream source;
+    TextSink sink(true, hexMode, ';', source);
+    NpDisassembler disasm(hexMode, version);
+    disasm.AddSink(&sink);
+    // The whole image, not only its first 2K bank
+    disasm.SetWindow(0, binary.size());
+    disasm.disassemble(&binary, filename);
+
+    // Reassemble
+    NpAssembler assembler(hexMode);
+    std::vector<uint8_t> output;
+    if (!assembler.Assemble(source, output))
+    {
+        return "assembly error, " + assembler.Errors().front();
+    }
+
+    // Compare
+    size_t size = std::min(binary.size(), output.size());
+    for (size_t i = 0; i < size; i++)
+    {
+        if (binary[i] != output[i])
+        {
+            return "differs at byte " + std::to_string(i);
+        }
+    }
+    if (output.size() < binary.size())
+    {
+        return "reassembled binary is shorter";
+    }
+    if (output.size() > binary.size())
+    {
+        return "reassembled binary is longer";
+    }
+    return "";
+}
+
+/// @brief Round-trip verification of a list of binary files, one worker per CPU
+int verify(const std::vector<std::string> &filenames, bool hexMode)
+{
+    std::vector<std::string> results(filenames.size());
+    std::atomic<size_t> next(0);
+
+    unsigned workers = std::thread::hardware_concurrency();
+    workers = std::max(1u, std::min(workers, (unsigned)filenames.size()));
+    std::vector<std::thread> threads;
+    for (unsigned w = 0; w < workers; w++)
+    {
+        threads.push_back(std::thread([&]() {
+            size_t i;
+            while ((i = next++) < filenames.size())
+            {
+                results[i] = verifyFile(filenames[i], hexMode);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        threads[t].join();
+    }
+
+    size_t failed = 0;
+    for (size_t i = 0; i < filenames.size(); i++)
+    {
+        if (results[i].empty())
+        {
+            std::cout << "OK    " << filenames[i] << std::endl;
+        }
+        else
+        {
+            std::cout << "FAIL  " << filenames[i] << ": " << results[i] << std::endl;
+            failed++;
+        }
+    }
+    std::cout << filenames.size() - failed << " of " << filenames.size() << " files round-trip\n";
+    return (failed == 0) ? 0 : -1;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+		showUsage();
+        return -1;
+    }
+
+    // Command line options
+    std::string inputFilename;
+    std::string outputFilename;
+    bool overwriteOutput = false;
+    bool hexMode = false;
+    bool verifyMode = false;
+
+    static const struct option longOptions[] =
+    {
+        {"verify", no_argument, NULL, 'y'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, ":o:hvfxy", longOptions, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':  // set output file name
+                outputFilename = optarg;
+                break;
+            case 'h':  // help
+                showHelp();
+                return 0;
+                break;
+            case 'v':  // app version
+				showVersion();
+                return 0;
+                break;
+            case 'f':  // overwrite output file without warning
+                overwriteOutput = true;
+                break;
+            case 'x':  // hexadecimal numbers
+                hexMode = true;
+                break;
+            case 'y':  // round-trip verification
+                verifyMode = true;
+                break;
+            case '?':  // ERROR: Invalid option
+                std::cerr << "Unknown option: -" << char(optopt) << std::endl;
+                return -1;
+                break;
+            case ':':  // ERROR: No option argument
+                std::cerr << "Missing file name (option -" << char(optopt) << ").\n";
+                return -1;
+                break;
+            default:  // (shall not reach here.. but..)
+                return -1;
+                break;
+        }
+    }
+
+	// Missing input file name
+	if (optind >= argc)
+    {
+		showUsage();
+		return -1;
+    }
+
+    if (verifyMode)
+    {
+        return verify(std::vector<std::string>(argv + optind, argv + argc), hexMode);
+    }
+
+    // Define input file name
+	inputFilename = argv[optind++];
+
+	// Error on any extra non-option arguments
+	while (optind < argc)
+	{
+		std::cerr << "Invalid argument " << argv[optind++] << std::endl;
+		return -1;
+	}
+
+    // Assemble source file
+    std::ifstream inFileStream(inputFilename.c_str());
+    if (!inFileStream.is_open())
+    {
+		std::cerr << "Error reading file '" << inputFilename << "'\n";
+		return -1;
+	}
+    NpAssembler assembler(hexMode);
+    std::vector<uint8_t> binary;
+    if (!assembler.Assemble(inFileStream, binary))
+    {
+        for (size_t i = 0; i < assembler.Errors().size(); i++)
+        {
+            std::cerr << inputFilename << ": " << assembler.Errors()[i] << std::endl;
+        }
+        return -1;
+    }
+
+    // Define output file
+    if (outputFilename.empty())
+    {
+        size_t lastdot = inputFilename.find_last_of(".");
+        outputFilename = inputFilename.substr(0, lastdot) + binExtension;
+	}
+
+    // Confirm overwrite output file
+    std::ifstream testFileStream(outputFilename);
+    bool fileExist = testFileStream.is_open();
+    testFileStream.close();
+    if (fileExist && !overwriteOutput)
+    {
+        char answer;
+        std::cout << "File: " << outputFilename << "\nAlready exist. Overwrite it? [y/n]";
+        std::cin >> answer;
+        if (toupper(answer) != 'Y')
+        {
+            std::cerr << "Halted.\n";
+            return -1;
+        }
+    }
+
+    std::ofstream outFileStream(outputFilename, std::ios::out | std::ios::binary);
+    if (!outFileStream.is_open())
+    {
+        std::cerr << "Error writing file " << outputFilename << std::endl;
+        return -1;
+    }
+    outFileStream.write((const char *)binary.data(), binary.size());
+    outFileStream.close();
+    std::cout << "Output file: " << outputFilename << " (" << binary.size() << " Bytes)" << std::endl;
+    if (assembler.Origin() != 0)
+    {
+        std::cout << "Origin: 0x" << std::hex << assembler.Origin() << std::dec << std::endl;
+    }
+
+    return 0;
+}
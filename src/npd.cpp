@@ -22,27 +22,25 @@
 #include <iostream>
 #include <time.h>
 #include <iomanip> //std::hex oct
-#include <algorithm>  // find
+#include <algorithm>  // min, max
 
 #include "npd.h"
 
 // Constructor
-NpDisassembler::NpDisassembler(bool asmOut, 
-                               bool hexMode, 
-                               char commentChar, 
-                               const std::string &version, 
-                               std::ostream& outStream)
-: m_asmOutput(asmOut), m_commentChar(commentChar), m_version(version), m_outStream(outStream)
-{
-    m_romSize = 0;  // No binary data yet
-    // set line bar characters according to comment character option
-    m_barChar = '*';
-	if (m_commentChar == ';')
-	{
-	    m_barChar = '-';
-	}
+NpDisassembler::NpDisassembler(bool hexMode, 
+                               const std::string &version)
+: m_version(version)
+{
+    // No binary data yet. Default window
+    m_origin = 0;
+    m_imageEnd = 0;
+    m_windowStart = 0;
+    m_windowEnd = 0;
+    m_start = 0;
+    m_end = 0;
+    m_line = ListingLine();
 
-    // set numeric mode hex/octal
+    // set numeric mode hex/octal of label names
     if (hexMode)
     {
         m_decoder.SetHexMode();
@@ -57,78 +55,174 @@ NpDisassembler::~NpDisassembler()
 {
 }
 
-/// @brief Disassemble binary vector to output stream
+/// @brief Include an output sink. Sinks are owned by the caller
+void NpDisassembler::AddSink(OutputSink *pSink)
+{
+    m_sinks.push_back(pSink);
+}
+
+/// @brief Decode only the addresses from 'start' up to, not including, 'end'
+/// 'start' 0 is the origin. 'end' 0 is the end of the 2K bank of 'start'
+void NpDisassembler::SetWindow(size_t start, size_t end)
+{
+    m_windowStart = start;
+    m_windowEnd = end;
+}
+
+/// @brief Disassemble binary vector to all output sinks
 void NpDisassembler::disassemble(std::vector<uint8_t> const *pInput, 
                                  const std::string &filename)
 {
-	pBinary = pInput;
-    m_romSize = (MaxRomSize < pBinary->size()) ? MaxRomSize : pBinary->size();
-    
-    std::string comment;
+    SetImage(pInput);
 
 	// Header
-	AddBarLine(LongBarSize);
-    comment = "npd " + m_version + " - Nanoprocessor Disassembler";
-	AddCommentLine(comment);
-	
-	// Add file name
-    comment.erase();
-	comment.append("File: ");
-	comment.append(filename.substr(filename.find_last_of("/\\") + 1));
-	comment.append("   (");
-	comment.append(std::to_string(m_romSize));
-	comment.append(" Bytes)");	
-	AddCommentLine(comment);
+    ListingHeader header;
+    header.version = m_version;
+	header.filename = filename.substr(filename.find_last_of("/\\") + 1);
+    header.size = pBinary->size();
 
     // Add date and time
     time_t rawtime = time(NULL);
-    // Convert time_t to tm as local time
-    struct tm *timeinfo;
-    timeinfo = localtime (&rawtime);  
+    // Convert time_t to tm as local time. Archive workers run concurrently
+    struct tm timeinfo;
+#if !defined(_WIN32)
+    localtime_r(&rawtime, &timeinfo);
+#else
+    localtime_s(&timeinfo, &rawtime);
+#endif
     // Format time as string
     char buffer [40];
-    strftime(buffer, 40, "Date: %Y-%m-%d   %H:%M", timeinfo);
-    comment.erase();
-    comment.append(buffer);
-    AddCommentLine(comment);
+    strftime(buffer, 40, "%Y-%m-%d   %H:%M", &timeinfo);
+    header.date = buffer;
+	
+	m_onePassActive = m_onePass && isOnePassCompatible();
+	m_onePassUsed = m_onePassActive;
+	if (m_onePassActive)
+	{
+	    StartOnePass();
+	}
+	else
+	{
+	    FirstPass();
+	}
+	MatchSignatures();
+	ApplyRegions();
+	ApplySymbols();
+	AnalyzeUsage();
 
-    // Add mode: Octal / Hex
-    if (m_decoder.isHexMode())
+    for (size_t i = 0; i < m_sinks.size(); i++)
+    {
+        m_sinks[i]->Begin(header);
+    }
+    for (size_t i = 0; i < m_headerComments.size(); i++)
+    {
+        AddCommentLine(m_headerComments[i]);
+    }
+    if ((m_origin != 0) || (m_windowStart != 0) || (m_windowEnd != 0))
+    {
+        m_line.type = ListingLine::Window;
+        m_line.address = (uint16_t)m_start;
+        m_line.endAddress = (uint16_t)(m_end - 1);
+        Emit(m_line);
+    }
+	SecondPass();
+    for (size_t i = 0; i < m_sinks.size(); i++)
     {
-		AddCommentLine("Mode: Hexadecimal");
+        m_sinks[i]->Finish();
+    }
+}
+
+/// @brief Write only the lines of the addresses from 'start' up to, not
+/// including, 'end' to all output sinks: no header and no END line
+/// Labels come from the banks overlapping the range, so a viewer can
+/// render any part of a large image in time and memory bound by the range
+void NpDisassembler::render(std::vector<uint8_t> const *pInput, size_t start, size_t end)
+{
+    SetWindow(start, end);
+    SetImage(pInput);
+
+	m_onePassActive = m_onePass && isOnePassCompatible();
+	m_onePassUsed = m_onePassActive;
+	if (m_onePassActive)
+	{
+	    StartOnePass();
 	}
 	else
 	{
-		AddCommentLine("Mode: Octal");
+	    FirstPass();
 	}
-
-	AddBarLine(LongBarSize);
-	
-	FirstPass();
+	MatchSignatures();
+	ApplyRegions();
+	ApplySymbols();
+	AnalyzeUsage();
 	SecondPass();
 }
 
+/// @brief Set the binary, and the window clipped to the image
+void NpDisassembler::SetImage(std::vector<uint8_t> const *pInput)
+{
+	pBinary = pInput;
+    m_imageEnd = std::min(m_origin + pBinary->size(), MaxImageSize);
+
+    m_start = std::max(m_windowStart, m_origin);
+    m_end = m_windowEnd;
+    if (m_end == 0)
+    {
+        m_end = (m_start & ~(MaxRomSize - 1)) + MaxRomSize;
+    }
+    m_end = std::min(m_end, m_imageEnd);
+    m_start = std::min(m_start, m_end);
+}
+
 /// @brief Disassembly First Pass. Creates labelled address list
+/// Only the banks overlapping the window can jump into it
 void NpDisassembler::FirstPass()
+{
+    ClearLabels();
+    if (m_start >= m_end)
+    {
+        return;
+    }
+
+    for (size_t bank = m_start & ~(MaxRomSize - 1); bank < m_end; bank += MaxRomSize)
+    {
+        ScanBankLabels(std::max(bank, m_origin), std::min(bank + MaxRomSize, m_imageEnd));
+    }
+}
+
+/// @brief Empty the label list. The reset vector always has a label
+void NpDisassembler::ClearLabels()
 {
 	m_labelList.clear();
-	// The reset vector always has a label
+    m_labelMap.assign(m_end - m_start, false);
 	AddToLabelList(0);
-	
-    // collect labels from Direct Addressing instruction operands: JMP, JSB
-    uint16_t address = 0;
+}
+
+/// @brief Collect labels from Direct Addressing instruction operands: JMP, JSB
+/// Data regions are skipped
+void NpDisassembler::ScanBankLabels(size_t bankStart, size_t bankEnd)
+{
+    size_t address = bankStart;
     uint8_t opcode;
     uint8_t parameter;
+    RegionMap::Cursor regions(Regions(), bankStart);
     
-    while( (size_t)address < m_romSize-1 )
+    while( address + 1 < bankEnd )
     {
-        opcode = pBinary->at(address++);
-        if (m_decoder.isTwoByteInstruction(opcode))
+        const Region *pData = regions.At(address);
+        if (pData != NULL)
         {
-            parameter = pBinary->at(address++);
+            address = pData->end + 1;
+            continue;
+        }
+
+        opcode = ByteAt(address++);
+        if (m_decoder.isTwoByteInstruction(opcode) && (address < regions.NextStart(address)))
+        {
+            parameter = ByteAt(address++);
             if (m_decoder.isDirectAddressing(opcode))
             {
-                AddToLabelList( m_decoder.DirectAddress(opcode, parameter) );
+                AddToLabelList( m_decoder.BankedAddress((uint16_t)bankStart, opcode, parameter) );
             }
         }
     } 
@@ -137,85 +231,241 @@ void NpDisassembler::FirstPass()
 /// @brief Disassembly Second Pass
 void NpDisassembler::SecondPass()
 {
-    uint16_t address = 0;  // Program counter
+    size_t address = m_start;  // Program counter
     uint8_t opcode = 0;  // current instruction
     uint8_t parameter = 0;  // current instruction parameter
-    std::string mnemonic;
-    std::string comment;
-    std::string text;
+    RegionMap::Cursor regions(Regions(), m_start);
+
+    // Idiom matcher state and addresses of the latest instructions
+    uint32_t idiomState = 0;
+    size_t instructionCount = 0;
+    std::vector<uint16_t> recentAddresses;
+    if (m_pIdioms != NULL)
+    {
+        idiomState = m_pIdioms->Start();
+        recentAddresses.resize(std::max(m_pIdioms->MaxPatternSize(), (size_t)1));
+    }
     
-    while( (size_t)address < m_romSize )
+    while( address < m_end )
     {
-		// Add Label
-		if (hasLabel(address))
+        // One-pass: scan the labels up to here. The lines of a bank are
+        // written once its scan is done: no later label can point into it
+        if (m_onePassActive)
+        {
+            ScanLabelsTo(address);
+            if ((address & ~(MaxRomSize - 1)) != m_lineBank)
+            {
+                FlushLines();
+                m_lineBank = address & ~(MaxRomSize - 1);
+            }
+        }
+
+		// Add Label. One-pass reserves a slot for a later backward jump
+		if (hasLabel((uint16_t)address))
 		{
-			AddLabelLine(address);
+			AddLabelLine((uint16_t)address);
 		}
+		else if (m_onePassActive)
+		{
+		    m_labelSlots[address - m_start] = (uint32_t)m_pendingLines.size();
+		}
+
+        // Data directives. Idioms do not match across data
+        const Region *pData = regions.At(address);
+        if (pData != NULL)
+        {
+            address = AddDataLines(*pData, address, std::min(pData->end + 1, m_end));
+            if (m_pIdioms != NULL)
+            {
+                idiomState = m_pIdioms->Start();
+            }
+            continue;
+        }
 
         // get instruction opcode
-		opcode = pBinary->at(address);
-
-        // Build new text line
-        text.erase();
-		// Add Address and opcode byte (.lst output only)
-		if (!m_asmOutput)
-	    {
-			m_decoder.AppendAddressString(address, text);
-			text.append(":  ");
-			m_decoder.AppendByteString(opcode, text);
-		}
+		opcode = ByteAt(address);
+		uint16_t instructionAddress = (uint16_t)address;
 
         // get instruction parameter (only for two byte instructions)
         parameter = 0;
+        m_line.size = 1;
         if (m_decoder.isTwoByteInstruction(opcode) && 
-            ((size_t)address < m_romSize-1))
+            (address < m_end-1) && (address + 1 < regions.NextStart(address)))
+        {
+			parameter = ByteAt(++address);
+            m_line.size = 2;
+		}
+
+        // Label name of JMP and JSB operands. Sinks format default names
+        m_line.text.erase();
+        if (m_decoder.isDirectAddressing(opcode))
         {
-			parameter = pBinary->at(++address);
-			// Include parameter byte (.lst output only)
-            if (!m_asmOutput)
+            uint16_t target = m_decoder.BankedAddress(instructionAddress, opcode, parameter);
+            Symbol symbol;
+            if ((m_labelNames.count(target) != 0) ||
+                ((m_pSymbols != NULL) && m_pSymbols->Find(target, symbol) && (*symbol.name != '\0')))
             {
-                text.push_back(' ');
-                m_decoder.AppendByteString(parameter, text);
+                m_line.text = LabelName(target);
             }
-		}
-        
-        // Translate opcode
-        m_decoder.TranslateOpCode(opcode, parameter, mnemonic, comment);
+        }
+
+        m_line.type = ListingLine::Instruction;
+        m_line.address = instructionAddress;
+        m_line.opcode = opcode;
+        m_line.parameter = parameter;
+        Emit(m_line);
+
+        // One-pass: the label scan is at this instruction, and decodes it
+        // the same way unless it is cut by the window end. Decode it once.
+        // After its line: a jump to itself fills its own label slot
+        if (m_onePassActive && (m_scanAddress == instructionAddress) &&
+            (m_line.size == (m_decoder.isTwoByteInstruction(opcode) ? 2 : 1)))
+        {
+            ScanInstruction(opcode, parameter);
+        }
 
-		// Add Instruction and comment
-        AppendTab(InstructionTabSize, text);
-        text.append(mnemonic);
-        AppendComment(text, comment);
-        m_outStream << text << std::endl;
+        // Add comments of the idioms ending at this instruction
+        if (m_pIdioms != NULL)
+        {
+            recentAddresses[instructionCount % recentAddresses.size()] = instructionAddress;
+            instructionCount++;
+            idiomState = m_pIdioms->Next(idiomState, opcode);
+            if (!m_pIdioms->Matches(idiomState).empty())
+            {
+                AddIdiomLines(idiomState, recentAddresses, instructionCount);
+            }
+        }
 
         // Add line after 'Jump' and 'Return' type instructions
         if ( m_decoder.isReturnOrJumpInstruction(opcode) )
         {
-            AddBarLine(ShortBarSize);
+            AddBarLine(ListingLine::JumpBar);
         }
         
         // Add line after 'Skip' type instructions
         if (m_decoder.isSkipInstruction(opcode))
         {
-			AddBarLine(TinyBarSize);
+			AddBarLine(ListingLine::SkipBar);
 		}
         
         // Next instruction
 		address++;
 	}
-	
-	// End
-    text.erase();
-    AppendTab(InstructionTabSize, text);
-    m_outStream << text << "END\n";
+
+    if (m_onePassActive)
+    {
+        ScanLabelsTo(SIZE_MAX);
+        FlushLines();
+        m_onePassActive = false;
+    }
+}
+
+/// @brief One-pass mode needs labels only from JMP and JSB. Signature
+/// matching, usage analysis, and data regions depend on the whole label
+/// list: those disassemblies fall back to two passes
+bool NpDisassembler::isOnePassCompatible() const
+{
+    if (((m_pSignatures != NULL) && (m_pSignatures->size() != 0)) || (m_pUsage != NULL))
+    {
+        return false;
+    }
+    // No data region in the scanned banks
+    size_t firstBank = m_start & ~(MaxRomSize - 1);
+    RegionMap::Cursor regions(Regions(), firstBank);
+    return regions.NextStart(firstBank) >= ((m_end + MaxRomSize - 1) & ~(MaxRomSize - 1));
+}
+
+/// @brief Start a one-pass disassembly: empty labels, slots, and scan state
+void NpDisassembler::StartOnePass()
+{
+    ClearLabels();
+    m_labelSlots.assign(m_end - m_start, (uint32_t)NoSlot);
+    m_pendingLines.clear();
+    m_patchedLines.clear();
+    m_lineBank = m_start & ~(MaxRomSize - 1);
+    m_scanBank = m_lineBank;
+    m_scanAddress = std::max(m_scanBank, m_origin);
+}
+
+/// @brief One-pass label scan of the instructions before 'limit'
+/// Same decoding as ScanBankLabels, bank by bank. Only the instructions
+/// the rendering does not decode at the scan address are read here
+void NpDisassembler::ScanLabelsTo(size_t limit)
+{
+    while ((m_scanBank < m_end) && (m_start < m_end))
+    {
+        size_t bankEnd = std::min(m_scanBank + MaxRomSize, m_imageEnd);
+        while ((m_scanAddress + 1 < bankEnd) && (m_scanAddress < limit))
+        {
+            uint8_t opcode = ByteAt(m_scanAddress);
+            uint8_t parameter = m_decoder.isTwoByteInstruction(opcode) ? ByteAt(m_scanAddress + 1) : 0;
+            ScanInstruction(opcode, parameter);
+        }
+        if (m_scanAddress + 1 < bankEnd)
+        {
+            return;
+        }
+        m_scanBank += MaxRomSize;
+        m_scanAddress = std::max(m_scanBank, m_origin);
+    }
+}
+
+/// @brief Label of an instruction at the one-pass scan address, and step
+/// over it. A label behind the rendered lines fills its reserved slot
+void NpDisassembler::ScanInstruction(uint8_t opcode, uint8_t parameter)
+{
+    size_t bankStart = std::max(m_scanBank, m_origin);
+    m_scanAddress++;
+    if (!m_decoder.isTwoByteInstruction(opcode))
+    {
+        return;
+    }
+    m_scanAddress++;
+    if (m_decoder.isDirectAddressing(opcode))
+    {
+        uint16_t target = m_decoder.BankedAddress((uint16_t)bankStart, opcode, parameter);
+        if ((target >= m_start) && (target < m_end) && !hasLabel(target))
+        {
+            AddToLabelList(target);
+            uint32_t slot = m_labelSlots[target - m_start];
+            if (slot != NoSlot)
+            {
+                m_patchedLines[slot] = true;
+            }
+        }
+    }
+}
+
+/// @brief Write the held lines, and the labels patched in their slots
+void NpDisassembler::FlushLines()
+{
+    for (size_t i = 0; i < m_pendingLines.size(); i++)
+    {
+        if (m_patchedLines[i])
+        {
+            ListingLine label = m_pendingLines[i];
+            label.type = ListingLine::Label;
+            label.text.erase();
+            std::map<uint16_t, std::string>::const_iterator name = m_labelNames.find(label.address);
+            if (name != m_labelNames.end())
+            {
+                label.text = name->second;
+            }
+            WriteLine(label);
+        }
+        WriteLine(m_pendingLines[i]);
+    }
+    m_pendingLines.clear();
+    m_patchedLines.clear();
 }
 
 /// @brief Include address in the to-be-Label list
-/// Insert address once in the list
+/// Insert window addresses once in the list
 void NpDisassembler::AddToLabelList(uint16_t address)
 {
-	if (!hasLabel(address))
+	if ((address >= m_start) && (address < m_end) && !hasLabel(address))
 	{
+        m_labelMap[address - m_start] = true;
 		m_labelList.push_back(address);
 	}
 }
@@ -224,59 +474,372 @@ void NpDisassembler::AddToLabelList(uint16_t address)
 /// @return true if it does
 bool NpDisassembler::hasLabel(uint16_t address) const
 {
-    return (std::find(m_labelList.begin(), m_labelList.end(), address) != m_labelList.end());
+    return (address >= m_start) && (address < m_end) && m_labelMap[address - m_start];
+}
+
+/// @brief Label text of an address
+/// @return Label name, symbol name, or the default 'L_' + address
+std::string NpDisassembler::LabelName(uint16_t address) const
+{
+    std::map<uint16_t, std::string>::const_iterator it = m_labelNames.find(address);
+    if (it != m_labelNames.end())
+    {
+        return it->second;
+    }
+    Symbol symbol;
+    if ((m_pSymbols != NULL) && m_pSymbols->Find(address, symbol) && (*symbol.name != '\0'))
+    {
+        return symbol.name;
+    }
+
+    std::string text("L_");
+    m_decoder.AppendAddressString(address, text);
+    return text;
 }
 
-/// @brief Add spaces to align text in columns
-void NpDisassembler::AppendTab(int tabSize, std::string &text)
+/// @brief Hash the relocation-normalized code of a routine
+/// The routine runs from 'address' up to its first Jump or Return
+/// instruction. JMP and JSB page and offset are masked out.
+/// Routines end at their bank end.
+/// @return false if the routine is too short to be recognized
+bool NpDisassembler::RoutineFingerprint(uint16_t address, uint64_t &hash, uint16_t &length) const
 {
-    if (!m_asmOutput)
+    size_t pc = address;
+    size_t end = std::min((pc & ~(MaxRomSize - 1)) + MaxRomSize, m_imageEnd);
+    hash = SignatureDb::HashStart();
+    length = 0;
+
+    while ((pc < end) && (length < SignatureDb::MaxLength))
     {
-        tabSize += OpCodeTabSize;
+        uint8_t opcode = ByteAt(pc++);
+        uint8_t parameter = 0;
+        if (m_decoder.isTwoByteInstruction(opcode))
+        {
+            if (pc >= end)
+            {
+                break;
+            }
+            parameter = ByteAt(pc++);
+        }
+
+        // Relocation normalization: JMP L_xxxx and JSB L_xxxx
+        if (m_decoder.isDirectAddressing(opcode))
+        {
+            opcode = m_decoder.DirectAddressingOpCode(opcode);
+            parameter = 0;
+        }
+
+        hash = SignatureDb::HashByte(hash, opcode);
+        if (m_decoder.isTwoByteInstruction(opcode))
+        {
+            hash = SignatureDb::HashByte(hash, parameter);
+        }
+        length = (uint16_t)(pc - address);
+
+        if (m_decoder.isReturnOrJumpInstruction(opcode))
+        {
+            break;
+        }
+    }
+
+    return (length >= SignatureDb::MinLength);
+}
+
+/// @brief Rename labels of known routines
+void NpDisassembler::MatchSignatures()
+{
+    m_labelNames.clear();
+    m_labelComments.clear();
+    if ((m_pSignatures == NULL) || (m_pSignatures->size() == 0))
+    {
+        return;
     }
-    int tab = tabSize - text.size();
-    if (tab > 0)
+
+    // Matches by address: the first copy of a routine gets its name
+    std::map<uint16_t, const Signature *> matches;
+    uint64_t hash;
+    uint16_t length;
+    for (size_t i = 0; i < m_labelList.size(); i++)
     {
-        text.append(tab, ' ');
+        uint16_t address = m_labelList[i];
+        if (!RoutineFingerprint(address, hash, length))
+        {
+            continue;
+        }
+        const Signature *pSignature = m_pSignatures->Find(hash, length);
+        if (pSignature != NULL)
+        {
+            matches[address] = pSignature;
+        }
+    }
+
+    // Later copies keep their 'L_' name, labels must be unique
+    std::map<std::string, uint16_t> named;  // name, address
+    std::map<uint16_t, const Signature *>::const_iterator it;
+    for (it = matches.begin(); it != matches.end(); ++it)
+    {
+        const std::string &name = it->second->name;
+        if (named.count(name) == 0)
+        {
+            named[name] = it->first;
+            m_labelNames[it->first] = name;
+            m_labelComments[it->first].push_back("Routine: " + name + " (signature match)");
+        }
+        else
+        {
+            m_labelComments[it->first].push_back("Routine: copy of " + name + " (signature match)");
+        }
+    }
+}
+
+/// @brief Collect signatures of all labelled routines
+/// Call after 'disassemble'
+void NpDisassembler::CollectSignatures(SignatureDb &signatures) const
+{
+    Signature signature;
+    for (size_t i = 0; i < m_labelList.size(); i++)
+    {
+        uint16_t address = m_labelList[i];
+        if (RoutineFingerprint(address, signature.hash, signature.length))
+        {
+            signature.name = LabelName(address);
+            signatures.Add(signature);
+        }
     }
 }
 
-void NpDisassembler::AppendComment(std::string &text, const std::string &comment)
+/// @brief Enable register and device usage analysis
+/// Usage summaries are added as comments to the subroutine labels if 'addComments'
+void NpDisassembler::SetUsageAnalysis(UsageAnalysis *pUsage, bool addComments)
 {
-    AppendTab(CommentTabSize, text);
-	text.push_back(m_commentChar);
-	text.push_back(' ');
-	text.append(comment);
+    m_pUsage = pUsage;
+    m_usageComments = addComments;
 }
 
-void NpDisassembler::AddCommentLine(const std::string &comment)
+/// @brief Register and device usage of every subroutine
+/// Analyzes the whole first 2K bank, if the image starts at address 0
+void NpDisassembler::AnalyzeUsage()
 {
-    std::string text;
+    if ((m_pUsage == NULL) || (m_origin != 0) || (m_end > MaxRomSize))
+    {
+        return;
+    }
 
-    AppendTab(0, text);
-	text.push_back(m_commentChar);
-	text.push_back(' ');
-	text.append(comment);
-    m_outStream << text << std::endl;
+    m_pUsage->Analyze(m_decoder, pBinary, std::min(m_imageEnd, MaxRomSize));
+    std::vector<SubroutineUsage> &subroutines = m_pUsage->Subroutines();
+    for (size_t i = 0; i < subroutines.size(); i++)
+    {
+        subroutines[i].name = LabelName(subroutines[i].address);
+        if (m_usageComments)
+        {
+            UsageAnalysis::UsageComments(subroutines[i].usage, m_labelComments[subroutines[i].address]);
+        }
+    }
 }
 
-void NpDisassembler::AddBarLine(int n)
+/// @brief Region map in use, or an empty one
+const RegionMap &NpDisassembler::Regions() const
 {
-    std::string text;
+    static const RegionMap noRegions;
+    return (m_pRegions != NULL) ? *m_pRegions : noRegions;
+}
 
-    AppendTab(0, text);
-    text.push_back(m_commentChar);
-    text.append(n, m_barChar);
-    m_outStream << text << std::endl;
+/// @brief Labels and comments of the region map
+/// Regions with a label or a comment are labelled at their start
+void NpDisassembler::ApplyRegions()
+{
+    const RegionMap &regions = Regions();
+    for (size_t i = 0; i < regions.size(); i++)
+    {
+        const Region &region = regions.at(i);
+        if ((region.start < m_start) || (region.start >= m_end) ||
+            (region.label.empty() && region.comment.empty()))
+        {
+            continue;
+        }
+        AddToLabelList((uint16_t)region.start);
+        if (!region.label.empty())
+        {
+            m_labelNames[(uint16_t)region.start] = region.label;
+        }
+        if (!region.comment.empty())
+        {
+            m_labelComments[(uint16_t)region.start].push_back(region.comment);
+        }
+    }
 }
 
-void NpDisassembler::AddLabelLine(uint16_t x)
+/// @brief Names and comments of the symbol database
+/// Symbols are labelled. Their names win over signature and region names
+void NpDisassembler::ApplySymbols()
 {
-    std::string text;
+    if (m_pSymbols == NULL)
+    {
+        return;
+    }
+    std::vector<Symbol> symbols;
+    m_pSymbols->FindRange(m_start, m_end, symbols);
+    for (size_t i = 0; i < symbols.size(); i++)
+    {
+        const Symbol &symbol = symbols[i];
+        AddToLabelList(symbol.address);
+        if (*symbol.name != '\0')
+        {
+            m_labelNames[symbol.address] = symbol.name;
+        }
+        if (*symbol.comment != '\0')
+        {
+            m_labelComments[symbol.address].push_back(symbol.comment);
+        }
+    }
+}
+
+/// @brief Data directive lines from 'address' up to 'end'
+/// Lines break at labels. Text runs of ASCII regions are ASC lines
+/// @return the address after the data
+size_t NpDisassembler::AddDataLines(const Region &region, size_t address, size_t end)
+{
+    static const size_t BytesPerLine = 8;
+
+    size_t start = address;
+    while (address < end)
+    {
+        // The label of the first line is already written
+        if ((address != start) && hasLabel((uint16_t)address))
+        {
+            AddLabelLine((uint16_t)address);
+        }
+
+        size_t count = 0;
+        size_t maximum = BytesPerLine;
+        m_line.address = (uint16_t)address;
+        m_line.dataType = region.type;
+        if (region.type == Region::Ascii)
+        {
+            // Printable run, excluding the quote, or a DB line
+            uint8_t x = ByteAt(address);
+            bool text = (x >= ' ') && (x <= '~') && (x != '"');
+            if (text)
+            {
+                maximum = ListingLine::MaxData;
+            }
+            else
+            {
+                m_line.dataType = Region::Bytes;
+            }
+            while ((count < maximum) && (address + count < end) &&
+                   ((count == 0) || !hasLabel((uint16_t)(address + count))))
+            {
+                x = ByteAt(address + count);
+                if (text != ((x >= ' ') && (x <= '~') && (x != '"')))
+                {
+                    break;
+                }
+                m_line.data[count++] = x;
+            }
+        }
+        else
+        {
+            while ((count < maximum) && (address + count < end) &&
+                   ((count == 0) || !hasLabel((uint16_t)(address + count))))
+            {
+                m_line.data[count] = ByteAt(address + count);
+                count++;
+            }
+            // Odd byte of a word region
+            if ((region.type == Region::Words) && (count % 2))
+            {
+                if (count > 1)
+                {
+                    count--;
+                }
+                else
+                {
+                    m_line.dataType = Region::Bytes;
+                }
+            }
+        }
+
+        m_line.type = ListingLine::Data;
+        m_line.count = (uint16_t)count;
+        Emit(m_line);
+        address += count;
+    }
+    return address;
+}
+
+/// @brief Add a comment line for each idiom matched at 'state'
+/// 'recentAddresses' is a ring buffer of the latest 'count' instruction addresses
+void NpDisassembler::AddIdiomLines(uint32_t state, const std::vector<uint16_t> &recentAddresses, size_t count)
+{
+    const std::vector<uint16_t> &matches = m_pIdioms->Matches(state);
+    for (size_t i = 0; i < matches.size(); i++)
+    {
+        const IdiomRule &rule = m_pIdioms->Rule(matches[i]);
+        size_t size = rule.pattern.size();
+
+        // Comment template is expanded by the sinks
+        m_line.type = ListingLine::Idiom;
+        m_line.address = recentAddresses[(count - size) % recentAddresses.size()];
+        m_line.endAddress = recentAddresses[(count - 1) % recentAddresses.size()];
+        m_line.count = (uint16_t)size;
+        m_line.text = rule.comment;
+        Emit(m_line);
+    }
+}
+
+/// @brief Send a line to the sinks. One-pass mode holds it until its labels are known
+void NpDisassembler::Emit(const ListingLine &line)
+{
+    if (m_onePassActive)
+    {
+        m_pendingLines.push_back(line);
+        m_patchedLines.push_back(false);
+        return;
+    }
+    WriteLine(line);
+}
+
+/// @brief Write a line to all output sinks
+void NpDisassembler::WriteLine(const ListingLine &line)
+{
+    for (size_t i = 0; i < m_sinks.size(); i++)
+    {
+        m_sinks[i]->Write(line);
+    }
+}
+
+void NpDisassembler::AddCommentLine(const std::string &comment)
+{
+    m_line.type = ListingLine::Comment;
+    m_line.text = comment;
+    Emit(m_line);
+}
 
-    AppendTab(0, text);
-	text.append("L_");
-	m_decoder.AppendAddressString(x, text);
-    m_outStream << text << std::endl;
+void NpDisassembler::AddBarLine(ListingLine::Type bar)
+{
+    m_line.type = bar;
+    Emit(m_line);
 }
 
+void NpDisassembler::AddLabelLine(uint16_t x)
+{
+    m_line.type = ListingLine::Label;
+    m_line.address = x;
+    m_line.text.erase();
+    std::map<uint16_t, std::string>::const_iterator name = m_labelNames.find(x);
+    if (name != m_labelNames.end())
+    {
+        m_line.text = name->second;
+    }
+    Emit(m_line);
+
+    std::map<uint16_t, std::vector<std::string> >::const_iterator it = m_labelComments.find(x);
+    if (it != m_labelComments.end())
+    {
+        for (size_t i = 0; i < it->second.size(); i++)
+        {
+            AddCommentLine(it->second[i]);
+        }
+    }
+}
@@ -22,60 +22,138 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <map>
 
 #include "decoder.h"
+#include "sink.h"
+#include "signature.h"
+#include "idiom.h"
+#include "dataflow.h"
+#include "regionmap.h"
+#include "symboldb.h"
 
 /// @brief Disassembler class
+/// Decodes a binary once and writes the listing to all its output sinks
 class NpDisassembler
 {
 public:
-    NpDisassembler(bool asmOut, 
-                   bool hexMode, 
-                   char commentChar, 
-                   const std::string &version, 
-                   std::ostream& outStream);
+    NpDisassembler(bool hexMode, 
+                   const std::string &version);
     ~NpDisassembler();
+
+    void AddSink(OutputSink *pSink);
     
     void disassemble(std::vector<uint8_t> const *pInput, 
                      const std::string &filename);
+    void render(std::vector<uint8_t> const *pInput, size_t start, size_t end);
+
+    void SetSignatures(const SignatureDb *pSignatures) { m_pSignatures = pSignatures; };
+    void CollectSignatures(SignatureDb &signatures) const;
+    void SetIdioms(const IdiomMatcher *pIdioms) { m_pIdioms = pIdioms; };
+    void SetUsageAnalysis(UsageAnalysis *pUsage, bool addComments);
+    void SetRegions(const RegionMap *pRegions) { m_pRegions = pRegions; };
+    void SetSymbols(const SymbolDb *pSymbols) { m_pSymbols = pSymbols; };
+
+    void SetOrigin(uint16_t origin) { m_origin = origin; };
+    void SetWindow(size_t start, size_t end);
+    void SetOnePass(bool onePass) { m_onePass = onePass; };
+    bool isOnePassUsed() const { return m_onePassUsed; };
+    void AddHeaderComment(const std::string &comment) { m_headerComments.push_back(comment); };
+
+    // The Nanoprocessor address bus size is 11-bits
+    static constexpr size_t MaxRomSize = 2048; 
+    // Banked images: 2K banks in a 16-bit address space
+    static constexpr size_t MaxImageSize = 0x10000;
     
 private:
+    void SetImage(std::vector<uint8_t> const *pInput);
+    void ClearLabels();
     void FirstPass();
+    void ScanBankLabels(size_t bankStart, size_t bankEnd);
     void SecondPass();
+    bool isOnePassCompatible() const;
+    void StartOnePass();
+    void ScanLabelsTo(size_t limit);
+    void ScanInstruction(uint8_t opcode, uint8_t parameter);
+    void FlushLines();
     
+    uint8_t ByteAt(size_t address) const { return pBinary->at(address - m_origin); };
     void AddToLabelList(uint16_t address);
     bool hasLabel(uint16_t address) const;
+    std::string LabelName(uint16_t address) const;
+
+    bool RoutineFingerprint(uint16_t address, uint64_t &hash, uint16_t &length) const;
+    void MatchSignatures();
+
+    void AnalyzeUsage();
+    void ApplyRegions();
+    void ApplySymbols();
+    const RegionMap &Regions() const;
+    size_t AddDataLines(const Region &region, size_t address, size_t end);
+    void AddIdiomLines(uint32_t state, const std::vector<uint16_t> &recentAddresses, size_t count);
     
-    void AppendTab(int tabSize, std::string &textLine);
-    void AppendComment(std::string &text, const std::string &comment);
-    
+    void Emit(const ListingLine &line);
+    void WriteLine(const ListingLine &line);
     void AddCommentLine(const std::string &comment);
-    void AddBarLine(int n);
+    void AddBarLine(ListingLine::Type bar);
     void AddLabelLine(uint16_t x);
 
 private:
     // Instruction decoder
     Decoder m_decoder;
 
-    bool m_asmOutput;
-    char m_commentChar;
 	std::string m_version;
     
-    char m_barChar;
-    size_t m_romSize;
 	std::vector<uint8_t> const *pBinary=NULL;
-    std::ostream& m_outStream;
+
+    // Address of the first binary byte, end of the image, and the
+    // decoded window [m_start, m_end). Window 0,0 is the first 2K
+    size_t m_origin;
+    size_t m_imageEnd;
+    size_t m_windowStart;
+    size_t m_windowEnd;
+    size_t m_start;
+    size_t m_end;
+
+    // Output sinks, and comments after the header
+    std::vector<OutputSink *> m_sinks;
+    std::vector<std::string> m_headerComments;
+    ListingLine m_line;
     
-    // Address Label List
+    // Address Label List, and a bitmap of the window labels
     std::vector<uint16_t> m_labelList;
+    std::vector<bool> m_labelMap;
+    // Label names and comments (default name is 'L_' + address)
+    std::map<uint16_t, std::string> m_labelNames;
+    std::map<uint16_t, std::vector<std::string> > m_labelComments;
 
-    // The Nanoprocessor address bus size is 11-bits
-    static constexpr size_t MaxRomSize = 2048; 
+    // Known routine signatures
+    const SignatureDb *m_pSignatures=NULL;
+
+    // Instruction idioms
+    const IdiomMatcher *m_pIdioms=NULL;
+
+    // Register and device usage per subroutine
+    UsageAnalysis *m_pUsage=NULL;
+    bool m_usageComments=false;
+
+    // Code and data address ranges
+    const RegionMap *m_pRegions=NULL;
+
+    // Names and comments of addresses
+    const SymbolDb *m_pSymbols=NULL;
 
-    static constexpr int OpCodeTabSize = 16;
-    static constexpr int InstructionTabSize = 10;
-    static constexpr int CommentTabSize = 26;
-    static constexpr int TinyBarSize = 13;
-    static constexpr int ShortBarSize = 26;
-    static constexpr int LongBarSize = 40;
+    // One-pass mode: lines of the current bank are held until its label
+    // scan is done. Each unlabelled instruction has a label slot: the
+    // index of its line, marked in m_patchedLines by a backward jump
+    bool m_onePass=false;
+    bool m_onePassActive=false;
+    bool m_onePassUsed=false;
+    std::vector<uint32_t> m_labelSlots;
+    std::vector<ListingLine> m_pendingLines;
+    std::vector<bool> m_patchedLines;
+    size_t m_lineBank=0;
+    size_t m_scanBank=0;
+    size_t m_scanAddress=0;
+    static constexpr uint32_t NoSlot = 0xFFFFFFFF;
 };
@@ -0,0 +1,248 @@
+/* npd project: regionmap.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// RegionMap class implementation
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>  // strtoul
+#include <algorithm>  // upper_bound
+
+#include "regionmap.h"
+
+/// @brief Parse an address: decimal, 0x hexadecimal, or 0 octal
+static bool ParseAddress(const std::string &text, size_t &address)
+{
+    char *end;
+    unsigned long value = strtoul(text.c_str(), &end, 0);
+    if (text.empty() || (*end != '\0') || (value > 0xFFFF))
+    {
+        return false;
+    }
+    address = value;
+    return true;
+}
+
+static bool StartsBefore(size_t address, const Region &region)
+{
+    return address < region.start;
+}
+
+RegionMap::RegionMap()
+{
+}
+
+RegionMap::~RegionMap()
+{
+}
+
+/// @brief Load regions from a map file
+/// @return false if the file can't be read or a region is invalid
+bool RegionMap::Load(const std::string &filename)
+{
+    std::ifstream inStream(filename.c_str());
+    if (!inStream.is_open())
+    {
+        std::cerr << "Error reading file '" << filename << "'\n";
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(inStream, line))
+    {
+        lineNumber++;
+        // Skip blank and comment lines
+        size_t first = line.find_first_not_of(" \t\r");
+        if ((first == std::string::npos) || (line[first] == '#'))
+        {
+            continue;
+        }
+
+        Region region;
+        size_t semicolon = line.find(';');
+        if (semicolon != std::string::npos)
+        {
+            size_t start = line.find_first_not_of(" \t", semicolon + 1);
+            size_t last = line.find_last_not_of(" \t\r");
+            if ((start != std::string::npos) && (start <= last))
+            {
+                region.comment = line.substr(start, last - start + 1);
+            }
+            line.erase(semicolon);
+        }
+
+        std::istringstream fields(line);
+        std::string start, end, type, extra;
+        fields >> start >> end >> type >> region.label >> extra;
+        if (!ParseAddress(start, region.start) || !ParseAddress(end, region.end) ||
+            (region.end < region.start) || !ParseType(type, region.type) || !extra.empty())
+        {
+            std::cerr << "Invalid region at " << filename << ":" << lineNumber << std::endl;
+            return false;
+        }
+        if (!Add(region))
+        {
+            std::cerr << "Overlapping region at " << filename << ":" << lineNumber << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Write the regions as a map file
+/// @return false if the file can't be written
+bool RegionMap::Save(const std::string &filename) const
+{
+    std::ofstream outStream(filename.c_str());
+    if (!outStream.is_open())
+    {
+        std::cerr << "Error writing file " << filename << std::endl;
+        return false;
+    }
+
+    outStream << std::hex << std::uppercase << std::setfill('0');
+    for (size_t i = 0; i < m_regions.size(); i++)
+    {
+        const Region &region = m_regions[i];
+        outStream << "0x" << std::setw(4) << region.start << " 0x" << std::setw(4) << region.end
+                  << " " << TypeName(region.type);
+        if (!region.label.empty())
+        {
+            outStream << " " << region.label;
+        }
+        if (!region.comment.empty())
+        {
+            outStream << " ; " << region.comment;
+        }
+        outStream << "\n";
+    }
+    return outStream.good();
+}
+
+/// @brief Insert a region in address order
+/// @return false if it overlaps another region
+bool RegionMap::Add(const Region &region)
+{
+    std::vector<Region>::iterator it = std::upper_bound(m_regions.begin(), m_regions.end(),
+                                                        region.start, StartsBefore);
+    if ((it != m_regions.begin()) && ((it - 1)->end >= region.start))
+    {
+        return false;
+    }
+    if ((it != m_regions.end()) && (it->start <= region.end))
+    {
+        return false;
+    }
+    m_regions.insert(it, region);
+    return true;
+}
+
+/// @brief Region of an address
+/// @return NULL if out of the map
+const Region *RegionMap::Find(size_t address) const
+{
+    std::vector<Region>::const_iterator it = std::upper_bound(m_regions.begin(), m_regions.end(),
+                                                              address, StartsBefore);
+    if ((it == m_regions.begin()) || ((it - 1)->end < address))
+    {
+        return NULL;
+    }
+    return &*(it - 1);
+}
+
+bool RegionMap::ParseType(const std::string &name, Region::Type &type)
+{
+    for (int i = Region::Code; i <= Region::Ascii; i++)
+    {
+        if (name == TypeName((Region::Type)i))
+        {
+            type = (Region::Type)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *RegionMap::TypeName(Region::Type type)
+{
+    switch (type)
+    {
+        case Region::Bytes:
+            return "bytes";
+        case Region::Words:
+            return "words";
+        case Region::Ascii:
+            return "ascii";
+        default:
+            return "code";
+    }
+}
+
+//------------------------------------------------------------
+// Cursor
+//------------------------------------------------------------
+
+RegionMap::Cursor::Cursor(const RegionMap &map, size_t address)
+: m_regions(map.m_regions)
+{
+    // Start at the first region ending at or after 'address'
+    m_index = std::upper_bound(m_regions.begin(), m_regions.end(), address, StartsBefore) - m_regions.begin();
+    if (m_index > 0)
+    {
+        m_index--;
+    }
+    Seek(address);
+}
+
+/// @brief Skip code regions and data regions ending before 'address'
+void RegionMap::Cursor::Seek(size_t address)
+{
+    while ((m_index < m_regions.size()) &&
+           ((m_regions[m_index].type == Region::Code) || (m_regions[m_index].end < address)))
+    {
+        m_index++;
+    }
+}
+
+/// @brief Data region of an address. Addresses may not decrease
+/// @return NULL if 'address' is code
+const Region *RegionMap::Cursor::At(size_t address)
+{
+    Seek(address);
+    if ((m_index < m_regions.size()) && (m_regions[m_index].start <= address))
+    {
+        return &m_regions[m_index];
+    }
+    return NULL;
+}
+
+/// @brief Start of the first data region at or after 'address'
+/// @return SIZE_MAX if none
+size_t RegionMap::Cursor::NextStart(size_t address)
+{
+    Seek(address);
+    if (m_index < m_regions.size())
+    {
+        return m_regions[m_index].start;
+    }
+    return SIZE_MAX;
+}
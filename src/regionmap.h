@@ -0,0 +1,91 @@
+/* npd project: regionmap.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/// @brief Address range of the image and how to list it
+struct Region
+{
+    enum Type
+    {
+        Code,   // instructions
+        Bytes,  // DB: 8 bytes per line
+        Words,  // DW: 4 words per line, high byte first
+        Ascii   // ASC: printable text, other bytes as DB
+    };
+
+    size_t start;
+    size_t end;  // last address
+    Type type;
+    std::string label;
+    std::string comment;
+};
+
+/// @brief Region map: code and data address ranges
+/// Map file, one region per line: 'START END TYPE [LABEL] [; COMMENT]'.
+/// START and END (the last address) are decimal, 0x hexadecimal, or 0 octal.
+/// TYPE is code, bytes, words, or ascii. Lines starting with '#' are comments.
+/// Addresses out of the map are code.
+///
+/// Regions are sorted by address and may not overlap. Find is a binary
+/// search; sequential scans use a Cursor that only moves forward, so a map
+/// of any size costs nothing per decoded byte.
+class RegionMap
+{
+public:
+    RegionMap();
+    ~RegionMap();
+
+    bool Load(const std::string &filename);
+    bool Save(const std::string &filename) const;
+    bool Add(const Region &region);
+
+    bool empty() const { return m_regions.empty(); };
+    size_t size() const { return m_regions.size(); };
+    const Region &at(size_t i) const { return m_regions.at(i); };
+    const Region *Find(size_t address) const;
+
+    static bool ParseType(const std::string &name, Region::Type &type);
+    static const char *TypeName(Region::Type type);
+
+    /// @brief Forward scan over the data regions
+    class Cursor
+    {
+    public:
+        Cursor(const RegionMap &map, size_t address);
+
+        const Region *At(size_t address);
+        size_t NextStart(size_t address);
+
+    private:
+        void Seek(size_t address);
+
+        const std::vector<Region> &m_regions;
+        size_t m_index;
+    };
+
+private:
+    // Sorted by start address
+    std::vector<Region> m_regions;
+};
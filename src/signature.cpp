@@ -0,0 +1,125 @@
+/* npd project: signature.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// SignatureDb class implementation
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip> //std::hex
+
+#include "signature.h"
+
+SignatureDb::SignatureDb()
+{
+}
+
+SignatureDb::~SignatureDb()
+{
+}
+
+/// @brief Load signatures from a text file
+/// @return false if the file can't be read
+bool SignatureDb::Load(const std::string &filename)
+{
+    std::ifstream inStream(filename.c_str());
+    if (!inStream.is_open())
+    {
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(inStream, line))
+    {
+        lineNumber++;
+        // Skip blank and comment lines
+        size_t first = line.find_first_not_of(" \t\r");
+        if ((first == std::string::npos) || (line[first] == '#'))
+        {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        Signature signature;
+        if (!(fields >> std::hex >> signature.hash >> std::dec >> signature.length >> signature.name))
+        {
+            std::cerr << "Invalid signature at " << filename << ":" << lineNumber << std::endl;
+            continue;
+        }
+        // Unedited names of collected routines are addresses of another binary
+        if (isDefaultLabelName(signature.name))
+        {
+            continue;
+        }
+        Add(signature);
+    }
+    return true;
+}
+
+/// @brief Append all signatures to a text file
+/// @return false if the file can't be written
+bool SignatureDb::Append(const std::string &filename,
+                         const std::string &source) const
+{
+    std::ofstream outStream(filename.c_str(), std::ios::out | std::ios::app);
+    if (!outStream.is_open())
+    {
+        return false;
+    }
+
+    outStream << "# " << source << std::endl;
+    for (size_t i = 0; i < m_signatures.size(); i++)
+    {
+        outStream << std::hex << std::setfill('0') << std::setw(16) << m_signatures[i].hash
+                  << std::dec << std::setfill(' ') << ' ' << std::setw(4) << m_signatures[i].length
+                  << ' ' << m_signatures[i].name << std::endl;
+    }
+    return true;
+}
+
+/// @brief Include a signature. The first one with a given hash wins
+void SignatureDb::Add(const Signature &signature)
+{
+    uint64_t key = Key(signature.hash, signature.length);
+    if (m_index.find(key) == m_index.end())
+    {
+        m_index[key] = m_signatures.size();
+        m_signatures.push_back(signature);
+    }
+}
+
+/// @brief Default label name of the disassembler: 'L_' and an address
+bool SignatureDb::isDefaultLabelName(const std::string &name)
+{
+    return (name.size() > 2) && (name.compare(0, 2, "L_") == 0) &&
+           (name.find_first_not_of("0123456789ABCDEF", 2) == std::string::npos);
+}
+
+/// @brief Search a signature by hash and length
+/// @return NULL if not found
+const Signature *SignatureDb::Find(uint64_t hash, uint16_t length) const
+{
+    std::unordered_map<uint64_t, size_t>::const_iterator it = m_index.find(Key(hash, length));
+    if ((it == m_index.end()) || (m_signatures[it->second].hash != hash))
+    {
+        return NULL;
+    }
+    return &m_signatures[it->second];
+}
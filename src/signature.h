@@ -0,0 +1,72 @@
+/* npd project: signature.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+/// @brief Known routine fingerprint: hash of its relocation-normalized code
+struct Signature
+{
+    uint64_t hash;
+    uint16_t length;
+    std::string name;
+};
+
+/// @brief Known routine signature database
+/// Text file, one signature per line: 'HASH LENGTH NAME'.
+/// Lines starting with '#' are comments. Signatures still named 'L_ADDRESS',
+/// as collected, are not loaded: only edited names are applied.
+class SignatureDb
+{
+public:
+    SignatureDb();
+    ~SignatureDb();
+
+    bool Load(const std::string &filename);
+    bool Append(const std::string &filename,
+                const std::string &source) const;
+
+    void Add(const Signature &signature);
+    const Signature *Find(uint64_t hash, uint16_t length) const;
+    size_t size() const { return m_signatures.size(); };
+    static bool isDefaultLabelName(const std::string &name);
+
+    // Rolling hash: H(n+1) = H(n) * HashBase + byte
+    static uint64_t HashStart() { return HashSeed; };
+    static uint64_t HashByte(uint64_t hash, uint8_t x) { return (hash * HashBase) + x + 1; };
+
+    // Shorter routines are too common to be recognized reliably
+    static constexpr uint16_t MinLength = 6;
+    static constexpr uint16_t MaxLength = 256;
+
+private:
+    static uint64_t Key(uint64_t hash, uint16_t length) { return hash ^ ((uint64_t)length << 48); };
+
+private:
+    std::vector<Signature> m_signatures;
+    // Lookup index: (hash, length) key -> signature list position
+    std::unordered_map<uint64_t, size_t> m_index;
+
+    static constexpr uint64_t HashSeed = 0xCBF29CE484222325ULL;
+    static constexpr uint64_t HashBase = 0x100000001B3ULL;
+};
@@ -0,0 +1,518 @@
+/* npd project: sink.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// Output sinks implementation
+
+#include <iostream>
+
+#include "sink.h"
+
+/// @brief Expand the '$s', '$e', and '$n' fields of an idiom comment template
+void ExpandIdiomText(const Decoder &decoder, const ListingLine &line, std::string &text)
+{
+    const std::string &pattern = line.text;
+    text.erase();
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        char c = pattern[i];
+        char next = (i + 1 < pattern.size()) ? pattern[i+1] : '\0';
+        if ((c == '$') && (next == 's'))
+        {
+            decoder.AppendAddressString(line.address, text);
+            i++;
+        }
+        else if ((c == '$') && (next == 'e'))
+        {
+            decoder.AppendAddressString(line.endAddress, text);
+            i++;
+        }
+        else if ((c == '$') && (next == 'n'))
+        {
+            text.append(std::to_string(line.count));
+            i++;
+        }
+        else
+        {
+            text.push_back(c);
+        }
+    }
+}
+
+/// @brief Translate an instruction line, using its JMP and JSB operand label name
+void InstructionText(const Decoder &decoder, const ListingLine &line,
+                     std::string &mnemonic, std::string &comment)
+{
+    decoder.TranslateOpCode(line.opcode, line.parameter, mnemonic, comment);
+
+    // Replace the 11-bit default label by the label name, or by the
+    // default name of the banked target
+    if (decoder.isDirectAddressing(line.opcode))
+    {
+        mnemonic.erase(mnemonic.find("L_"));
+        if (line.text.empty())
+        {
+            mnemonic.append("L_");
+            decoder.AppendAddressString(decoder.BankedAddress(line.address, line.opcode, line.parameter), mnemonic);
+        }
+        else
+        {
+            mnemonic.append(line.text);
+        }
+    }
+}
+
+/// @brief Data directive of a Data line: 'DB   ...', 'DW   ...', or 'ASC  "..."'
+void DataText(const Decoder &decoder, const ListingLine &line, std::string &directive)
+{
+    switch (line.dataType)
+    {
+        case Region::Ascii:
+            directive = "ASC  \"";
+            directive.append((const char *)line.data, line.count);
+            directive.push_back('"');
+            break;
+
+        case Region::Words:
+            directive = "DW   ";
+            for (size_t i = 0; i + 1 < line.count; i += 2)
+            {
+                if (i > 0)
+                {
+                    directive.push_back(',');
+                }
+                decoder.AppendAddressString((uint16_t)((line.data[i] << 8) | line.data[i + 1]), directive);
+            }
+            break;
+
+        default:
+            directive = "DB   ";
+            for (size_t i = 0; i < line.count; i++)
+            {
+                if (i > 0)
+                {
+                    directive.push_back(',');
+                }
+                decoder.AppendByteString(line.data[i], directive);
+            }
+            break;
+    }
+}
+
+/// @brief Comment text of a Window line
+void WindowText(const Decoder &decoder, const ListingLine &line, std::string &text)
+{
+    text = "Window: ";
+    decoder.AppendAddressString(line.address, text);
+    text.append(" to ");
+    decoder.AppendAddressString(line.endAddress, text);
+}
+
+//------------------------------------------------------------
+// TextSink
+//------------------------------------------------------------
+
+TextSink::TextSink(bool asmOut,
+                   bool hexMode,
+                   char commentChar,
+                   std::ostream& outStream)
+: m_asmOutput(asmOut), m_commentChar(commentChar), m_outStream(outStream)
+{
+    m_pIndex = NULL;
+    m_offset = 0;
+    m_lineCount = 0;
+
+    // set line bar characters according to comment character option
+    m_barChar = '*';
+	if (m_commentChar == ';')
+	{
+	    m_barChar = '-';
+	}
+
+    // set numeric mode hex/octal
+    if (hexMode)
+    {
+        m_decoder.SetHexMode();
+    }
+    else
+    {
+        m_decoder.SetOctalMode();
+    }
+}
+
+TextSink::~TextSink()
+{
+}
+
+/// @brief Listing header
+void TextSink::Begin(const ListingHeader &header)
+{
+    std::string comment;
+
+	AddBarLine(LongBarSize);
+    comment = "npd " + header.version + " - Nanoprocessor Disassembler";
+	AddCommentLine(comment);
+
+	// Add file name
+    comment.erase();
+	comment.append("File: ");
+	comment.append(header.filename);
+	comment.append("   (");
+	comment.append(std::to_string(header.size));
+	comment.append(" Bytes)");
+	AddCommentLine(comment);
+
+    // Add date and time
+    AddCommentLine("Date: " + header.date);
+
+    // Add mode: Octal / Hex
+    if (m_decoder.isHexMode())
+    {
+		AddCommentLine("Mode: Hexadecimal");
+	}
+	else
+	{
+		AddCommentLine("Mode: Octal");
+	}
+
+	AddBarLine(LongBarSize);
+}
+
+void TextSink::Write(const ListingLine &line)
+{
+    switch (line.type)
+    {
+        case ListingLine::Comment:
+            AddCommentLine(line.text);
+            break;
+        case ListingLine::Label:
+            AddLabelLine(line);
+            break;
+        case ListingLine::Instruction:
+            AddInstructionLine(line);
+            break;
+        case ListingLine::Idiom:
+            AddIdiomLine(line);
+            break;
+        case ListingLine::Data:
+            AddDataLine(line);
+            break;
+        case ListingLine::SkipBar:
+            AddBarLine(TinyBarSize);
+            break;
+        case ListingLine::JumpBar:
+            AddBarLine(ShortBarSize);
+            break;
+        case ListingLine::Window:
+            AddWindowLines(line);
+            break;
+    }
+}
+
+/// @brief Listing end
+void TextSink::Finish()
+{
+    std::string text;
+    AppendTab(InstructionTabSize, text);
+    text.append("END");
+    PutLine(text);
+    m_outStream.flush();
+}
+
+/// @brief Write a line, counting lines and bytes for the index
+void TextSink::PutLine(const std::string &text)
+{
+    m_outStream << text << std::endl;
+    m_offset += text.size() + 1;
+    m_lineCount++;
+}
+
+/// @brief Index the next line as the line of an address
+void TextSink::IndexLine(uint16_t address, const std::string &label)
+{
+    if (m_pIndex == NULL)
+    {
+        return;
+    }
+    if (label.empty())
+    {
+        m_pIndex->Add(address, m_lineCount + 1, m_offset);
+    }
+    else
+    {
+        m_pIndex->AddLabel(label, address, m_lineCount + 1, m_offset);
+    }
+}
+
+/// @brief Add spaces to align text in columns
+void TextSink::AppendTab(int tabSize, std::string &text)
+{
+    if (!m_asmOutput)
+    {
+        tabSize += OpCodeTabSize;
+    }
+    int tab = tabSize - text.size();
+    if (tab > 0)
+    {
+        text.append(tab, ' ');
+    }
+}
+
+void TextSink::AppendComment(std::string &text, const std::string &comment)
+{
+    AppendTab(CommentTabSize, text);
+	text.push_back(m_commentChar);
+	text.push_back(' ');
+	text.append(comment);
+}
+
+void TextSink::AddCommentLine(const std::string &comment)
+{
+    std::string text;
+
+    AppendTab(0, text);
+	text.push_back(m_commentChar);
+	text.push_back(' ');
+	text.append(comment);
+    PutLine(text);
+}
+
+void TextSink::AddBarLine(int n)
+{
+    std::string text;
+
+    AppendTab(0, text);
+    text.push_back(m_commentChar);
+    text.append(n, m_barChar);
+    PutLine(text);
+}
+
+void TextSink::AddLabelLine(const ListingLine &line)
+{
+    std::string name;
+    std::string text;
+
+    if (line.text.empty())
+    {
+        name.append("L_");
+        m_decoder.AppendAddressString(line.address, name);
+    }
+    else
+    {
+        name.append(line.text);
+    }
+    AppendTab(0, text);
+    text.append(name);
+    IndexLine(line.address, name);
+    PutLine(text);
+}
+
+void TextSink::AddInstructionLine(const ListingLine &line)
+{
+    std::string mnemonic;
+    std::string comment;
+    std::string text;
+
+    // Add Address and opcode byte (.lst output only)
+    if (!m_asmOutput)
+    {
+        m_decoder.AppendAddressString(line.address, text);
+        text.append(":  ");
+        m_decoder.AppendByteString(line.opcode, text);
+        // Include parameter byte
+        if (line.size > 1)
+        {
+            text.push_back(' ');
+            m_decoder.AppendByteString(line.parameter, text);
+        }
+    }
+
+    // Translate opcode. A .asm unknown opcode or instruction cut by the window end is a byte
+    InstructionText(m_decoder, line, mnemonic, comment);
+    if (m_asmOutput && (mnemonic == "???"))
+    {
+        comment = "Unknown opcode";
+        mnemonic = "DB   ";
+        m_decoder.AppendByteString(line.opcode, mnemonic);
+    }
+    else if (m_asmOutput && (line.size == 1) && m_decoder.isTwoByteInstruction(line.opcode))
+    {
+        comment = mnemonic.substr(0, mnemonic.find(' ')) + ", cut by the window end";
+        mnemonic = "DB   ";
+        m_decoder.AppendByteString(line.opcode, mnemonic);
+    }
+
+    // Add Instruction and comment
+    AppendTab(InstructionTabSize, text);
+    text.append(mnemonic);
+    AppendComment(text, comment);
+    IndexLine(line.address, "");
+    PutLine(text);
+}
+
+/// @brief Data directive. Bytes are not repeated in the opcode column
+void TextSink::AddDataLine(const ListingLine &line)
+{
+    std::string directive;
+    std::string text;
+
+    // Add Address (.lst output only)
+    if (!m_asmOutput)
+    {
+        m_decoder.AppendAddressString(line.address, text);
+        text.push_back(':');
+    }
+    DataText(m_decoder, line, directive);
+    AppendTab(InstructionTabSize, text);
+    text.append(directive);
+    IndexLine(line.address, "");
+    PutLine(text);
+}
+
+/// @brief Window comment. The .asm output starts at the window address
+void TextSink::AddWindowLines(const ListingLine &line)
+{
+    std::string text;
+    WindowText(m_decoder, line, text);
+    AddCommentLine(text);
+    if (m_asmOutput)
+    {
+        text.erase();
+        AppendTab(InstructionTabSize, text);
+        text.append("ORG  ");
+        m_decoder.AppendAddressString(line.address, text);
+        PutLine(text);
+    }
+}
+
+/// @brief Idiom comment
+void TextSink::AddIdiomLine(const ListingLine &line)
+{
+    std::string comment;
+    ExpandIdiomText(m_decoder, line, comment);
+    AddCommentLine(comment);
+}
+
+//------------------------------------------------------------
+// ThreadedSink
+//------------------------------------------------------------
+
+ThreadedSink::ThreadedSink(OutputSink *pSink, size_t queueSize)
+: m_pSink(pSink), m_queueSize(queueSize)
+{
+    m_batch.begin = false;
+    m_batch.finish = false;
+    m_batch.stop = false;
+    m_batch.lines.reserve(BatchSize);
+    m_worker = std::thread(&ThreadedSink::Run, this);
+}
+
+/// @brief Stop the worker if the output was not finished, i.e. on errors.
+/// Queued lines are dropped: an unfinished output gets no end
+ThreadedSink::~ThreadedSink()
+{
+    if (m_worker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.clear();
+            m_queue.push_back(Batch());
+            m_queue.back().begin = false;
+            m_queue.back().finish = false;
+            m_queue.back().stop = true;
+        }
+        m_notEmpty.notify_one();
+        m_worker.join();
+    }
+}
+
+void ThreadedSink::Begin(const ListingHeader &header)
+{
+    m_batch.begin = true;
+    m_batch.header = header;
+}
+
+void ThreadedSink::Write(const ListingLine &line)
+{
+    m_batch.lines.push_back(line);
+    if (m_batch.lines.size() >= BatchSize)
+    {
+        Push(m_batch);
+    }
+}
+
+/// @brief Flush the queue and wait for the sink to finish
+void ThreadedSink::Finish()
+{
+    m_batch.finish = true;
+    Push(m_batch);
+    m_worker.join();
+}
+
+/// @brief Queue a batch, waiting while the queue is full
+void ThreadedSink::Push(Batch &batch)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this]{ return m_queue.size() < m_queueSize; });
+        m_queue.push_back(Batch());
+        std::swap(m_queue.back(), batch);
+    }
+    m_notEmpty.notify_one();
+
+    batch.begin = false;
+    batch.finish = false;
+    batch.stop = false;
+    batch.lines.clear();
+    batch.lines.reserve(BatchSize);
+}
+
+/// @brief Worker thread: write queued batches to the sink
+void ThreadedSink::Run()
+{
+    bool finished = false;
+    while (!finished)
+    {
+        Batch batch;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [this]{ return !m_queue.empty(); });
+            std::swap(batch, m_queue.front());
+            m_queue.pop_front();
+        }
+        m_notFull.notify_one();
+
+        if (batch.stop)
+        {
+            break;
+        }
+        if (batch.begin)
+        {
+            m_pSink->Begin(batch.header);
+        }
+        for (size_t i = 0; i < batch.lines.size(); i++)
+        {
+            m_pSink->Write(batch.lines[i]);
+        }
+        if (batch.finish)
+        {
+            m_pSink->Finish();
+            finished = true;
+        }
+    }
+}
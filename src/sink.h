@@ -0,0 +1,183 @@
+/* npd project: sink.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <ostream>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "decoder.h"
+#include "regionmap.h"
+#include "listindex.h"
+
+/// @brief Listing header information
+struct ListingHeader
+{
+    std::string version;
+    std::string filename;
+    size_t size;  // image bytes, not only the window
+    std::string date;  // "YYYY-MM-DD   HH:MM"
+};
+
+/// @brief Decoded listing line, independent of the output format
+struct ListingLine
+{
+    static constexpr size_t MaxData = 32;
+
+    enum Type
+    {
+        Comment,      // text
+        Label,        // address, text: label name or empty for default
+        Instruction,  // address, opcode, parameter, size, text: operand label name or empty
+                      // for the default 'L_' name of the JMP and JSB target
+        Idiom,        // address to endAddress, count, text: comment template
+        Data,         // address, dataType, count bytes in data
+        SkipBar,      // after 'Skip' type instructions
+        JumpBar,      // after 'Jump' and 'Return' type instructions
+        Window        // address to endAddress: the decoded addresses
+    };
+
+    Type type;
+    uint16_t address;
+    uint16_t endAddress;
+    uint8_t opcode;
+    uint8_t parameter;
+    uint8_t size;
+    uint16_t count;
+    std::string text;
+    Region::Type dataType;
+    uint8_t data[MaxData];
+};
+
+void ExpandIdiomText(const Decoder &decoder, const ListingLine &line, std::string &text);
+void InstructionText(const Decoder &decoder, const ListingLine &line,
+                     std::string &mnemonic, std::string &comment);
+void DataText(const Decoder &decoder, const ListingLine &line, std::string &directive);
+void WindowText(const Decoder &decoder, const ListingLine &line, std::string &text);
+
+/// @brief Disassembly output interface
+/// A disassembly is decoded once and written to any number of sinks
+class OutputSink
+{
+public:
+    virtual ~OutputSink() {};
+
+    virtual void Begin(const ListingHeader &header) = 0;
+    virtual void Write(const ListingLine &line) = 0;
+    virtual void Finish() = 0;
+};
+
+/// @brief Text output: .lst (addresses and opcodes) or .asm
+class TextSink : public OutputSink
+{
+public:
+    TextSink(bool asmOut,
+             bool hexMode,
+             char commentChar,
+             std::ostream& outStream);
+    virtual ~TextSink();
+
+    virtual void Begin(const ListingHeader &header);
+    virtual void Write(const ListingLine &line);
+    virtual void Finish();
+
+    // Offsets count "\n" line ends: open an indexed stream in binary mode
+    void SetIndex(ListingIndex *pIndex) { m_pIndex = pIndex; };
+
+private:
+    void PutLine(const std::string &text);
+    void IndexLine(uint16_t address, const std::string &label);
+    void AppendTab(int tabSize, std::string &textLine);
+    void AppendComment(std::string &text, const std::string &comment);
+
+    void AddCommentLine(const std::string &comment);
+    void AddBarLine(int n);
+    void AddLabelLine(const ListingLine &line);
+    void AddInstructionLine(const ListingLine &line);
+    void AddIdiomLine(const ListingLine &line);
+    void AddDataLine(const ListingLine &line);
+    void AddWindowLines(const ListingLine &line);
+
+private:
+    // Instruction decoder
+    Decoder m_decoder;
+
+    bool m_asmOutput;
+    char m_commentChar;
+    char m_barChar;
+    std::ostream& m_outStream;
+
+    // Line starts of addresses and labels, optional
+    ListingIndex *m_pIndex;
+    uint64_t m_offset;
+    uint32_t m_lineCount;
+
+    static constexpr int OpCodeTabSize = 16;
+    static constexpr int InstructionTabSize = 10;
+    static constexpr int CommentTabSize = 26;
+    static constexpr int TinyBarSize = 13;
+    static constexpr int ShortBarSize = 26;
+    static constexpr int LongBarSize = 40;
+};
+
+/// @brief Runs a sink on its own thread behind a bounded queue
+class ThreadedSink : public OutputSink
+{
+public:
+    ThreadedSink(OutputSink *pSink, size_t queueSize = DefaultQueueSize);
+    virtual ~ThreadedSink();
+
+    virtual void Begin(const ListingHeader &header);
+    virtual void Write(const ListingLine &line);
+    virtual void Finish();
+
+private:
+    struct Batch
+    {
+        bool begin;
+        bool finish;
+        bool stop;  // unfinished output: exit without writing
+        ListingHeader header;
+        std::vector<ListingLine> lines;
+    };
+
+    void Push(Batch &batch);
+    void Run();
+
+private:
+    OutputSink *m_pSink;
+    size_t m_queueSize;
+    Batch m_batch;
+
+    std::deque<Batch> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::thread m_worker;
+
+    // Lines are queued in batches to keep locking out of the way
+    static constexpr size_t BatchSize = 256;
+    static constexpr size_t DefaultQueueSize = 16;
+};
@@ -0,0 +1,507 @@
+/* npd project: symboldb.cpp
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+// SymbolDb class implementation
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>  // strtoul
+#include <cstring>  // memcmp, strcmp
+#include <algorithm>  // sort, max
+#include <map>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "symboldb.h"
+
+static void Put16(std::vector<uint8_t> &out, uint16_t x)
+{
+    out.push_back((uint8_t)(x & 0xFF));
+    out.push_back((uint8_t)(x >> 8));
+}
+
+static void Put32(std::vector<uint8_t> &out, uint32_t x)
+{
+    Put16(out, (uint16_t)(x & 0xFFFF));
+    Put16(out, (uint16_t)(x >> 16));
+}
+
+static uint16_t Get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t Get32(const uint8_t *p)
+{
+    return Get16(p) | ((uint32_t)Get16(p + 2) << 16);
+}
+
+SymbolDb::SymbolDb()
+: m_pData(NULL), m_size(0), m_pMapping(NULL), m_mappingSize(0)
+{
+    Attach(NULL, 0, "");
+}
+
+SymbolDb::~SymbolDb()
+{
+    Unmap();
+}
+
+/// @brief Load a compiled database, or import a text file
+/// @return false if the file can't be read or is invalid
+bool SymbolDb::Load(const std::string &filename)
+{
+    std::ifstream testStream(filename.c_str(), std::ios::in | std::ios::binary);
+    char magic[4] = {0};
+    if (!testStream.is_open())
+    {
+        std::cerr << "Error reading file '" << filename << "'\n";
+        return false;
+    }
+    testStream.read(magic, sizeof(magic));
+    testStream.close();
+    if (memcmp(magic, "NPSY", 4) != 0)
+    {
+        return Import(filename);
+    }
+
+    Unmap();
+    m_buffer.clear();
+#if defined(_WIN32)
+    std::ifstream inStream(filename.c_str(), std::ios::in | std::ios::binary);
+    m_buffer.assign(std::istreambuf_iterator<char>(inStream), {});
+    return Attach(m_buffer.data(), m_buffer.size(), filename);
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat fileStat;
+    if ((fd < 0) || (fstat(fd, &fileStat) != 0))
+    {
+        std::cerr << "Error reading file '" << filename << "'\n";
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    size_t size = (size_t)fileStat.st_size;
+    void *pMapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pMapping == MAP_FAILED)
+    {
+        std::cerr << "Error reading file '" << filename << "'\n";
+        return false;
+    }
+    m_pMapping = pMapping;
+    m_mappingSize = size;
+    return Attach((const uint8_t *)pMapping, size, filename);
+#endif
+}
+
+void SymbolDb::Unmap()
+{
+#if !defined(_WIN32)
+    if (m_pMapping != NULL)
+    {
+        munmap(m_pMapping, m_mappingSize);
+    }
+#endif
+    m_pMapping = NULL;
+}
+
+/// @brief Compile a text file in memory
+/// @return false if the file can't be read or a symbol is invalid
+bool SymbolDb::Import(const std::string &filename)
+{
+    std::ifstream inStream(filename.c_str());
+    if (!inStream.is_open())
+    {
+        std::cerr << "Error reading file '" << filename << "'\n";
+        return false;
+    }
+
+    struct Record
+    {
+        std::string image;
+        uint16_t address;
+        std::string name;
+        std::string comment;
+        size_t line;
+    };
+    std::vector<Record> records;
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(inStream, line))
+    {
+        lineNumber++;
+        size_t first = line.find_first_not_of(" \t\r");
+        if ((first == std::string::npos) || (line[first] == '#'))
+        {
+            continue;
+        }
+
+        Record record;
+        record.line = lineNumber;
+        size_t semicolon = line.find(';');
+        if (semicolon != std::string::npos)
+        {
+            size_t start = line.find_first_not_of(" \t", semicolon + 1);
+            size_t last = line.find_last_not_of(" \t\r");
+            if ((start != std::string::npos) && (start <= last))
+            {
+                record.comment = line.substr(start, last - start + 1);
+            }
+            line.erase(semicolon);
+        }
+
+        std::istringstream fields(line);
+        std::string address, extra;
+        fields >> record.image >> address >> record.name >> extra;
+        char *end;
+        unsigned long value = strtoul(address.c_str(), &end, 0);
+        if (address.empty() || (*end != '\0') || (value > 0xFFFF) || record.name.empty() || !extra.empty() ||
+            ((record.name == "-") && record.comment.empty()))
+        {
+            std::cerr << "Invalid symbol at " << filename << ":" << lineNumber << std::endl;
+            return false;
+        }
+        record.address = (uint16_t)value;
+        if (record.name == "-")
+        {
+            record.name.erase();
+        }
+        records.push_back(record);
+    }
+
+    // Sort by image, then address
+    std::stable_sort(records.begin(), records.end(), [](const Record &a, const Record &b)
+    {
+        int order = a.image.compare(b.image);
+        return (order < 0) || ((order == 0) && (a.address < b.address));
+    });
+
+    // Label names are unique per image, counting the '*' symbols it does not hide
+    std::map<uint16_t, const Record *> globals;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        if (records[i].image == "*")
+        {
+            globals[records[i].address] = &records[i];
+        }
+    }
+    for (size_t i = 0; i < records.size(); )
+    {
+        size_t next = i;
+        std::map<std::string, const Record *> names;
+        std::map<uint16_t, const Record *> visible;
+        if (records[i].image != "*")
+        {
+            visible = globals;
+        }
+        while ((next < records.size()) && (records[next].image == records[i].image))
+        {
+            visible[records[next].address] = &records[next];
+            next++;
+        }
+        std::map<uint16_t, const Record *>::const_iterator it;
+        for (it = visible.begin(); it != visible.end(); ++it)
+        {
+            const Record &record = *it->second;
+            if (record.name.empty())
+            {
+                continue;
+            }
+            std::map<std::string, const Record *>::iterator other = names.find(record.name);
+            if (other != names.end())
+            {
+                size_t duplicateLine = std::max(record.line, other->second->line);
+                std::cerr << "Duplicate symbol name '" << record.name << "' at " << filename << ":"
+                          << duplicateLine << std::endl;
+                return false;
+            }
+            names[record.name] = &record;
+        }
+        i = next;
+    }
+
+    // Tables and string pool. Equal strings are pooled once
+    std::vector<uint8_t> images;
+    std::vector<uint8_t> symbols;
+    std::string pool(1, '\0');
+    std::unordered_map<std::string, uint32_t> pooled;
+    pooled[""] = 0;
+    auto poolString = [&](const std::string &text) -> uint32_t
+    {
+        std::unordered_map<std::string, uint32_t>::const_iterator it = pooled.find(text);
+        if (it != pooled.end())
+        {
+            return it->second;
+        }
+        uint32_t offset = (uint32_t)pool.size();
+        pool.append(text);
+        pool.push_back('\0');
+        pooled[text] = offset;
+        return offset;
+    };
+
+    uint32_t imageCount = 0;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const Record &record = records[i];
+        if ((i == 0) || (record.image != records[i - 1].image))
+        {
+            size_t count = 1;
+            while ((i + count < records.size()) && (records[i + count].image == record.image))
+            {
+                count++;
+            }
+            Put32(images, poolString(record.image));
+            Put32(images, (uint32_t)i);
+            Put32(images, (uint32_t)count);
+            imageCount++;
+        }
+        else if (record.address == records[i - 1].address)
+        {
+            std::cerr << "Duplicate symbol at " << filename << ":" << record.line << std::endl;
+            return false;
+        }
+        Put16(symbols, record.address);
+        Put16(symbols, 0);
+        Put32(symbols, poolString(record.name));
+        Put32(symbols, poolString(record.comment));
+    }
+
+    uint32_t poolOffset = HeaderSize + (uint32_t)(images.size() + symbols.size());
+    std::vector<uint8_t> buffer;
+    buffer.insert(buffer.end(), "NPSY", "NPSY" + 4);
+    Put16(buffer, FormatVersion);
+    Put16(buffer, 0);
+    Put32(buffer, imageCount);
+    Put32(buffer, (uint32_t)records.size());
+    Put32(buffer, poolOffset);
+    Put32(buffer, (uint32_t)pool.size());
+    Put32(buffer, 0);
+    Put32(buffer, 0);
+    buffer.insert(buffer.end(), images.begin(), images.end());
+    buffer.insert(buffer.end(), symbols.begin(), symbols.end());
+    buffer.insert(buffer.end(), pool.begin(), pool.end());
+
+    Unmap();
+    m_buffer.swap(buffer);
+    return Attach(m_buffer.data(), m_buffer.size(), filename);
+}
+
+/// @brief Write the compiled database
+/// @return false if the file can't be written
+bool SymbolDb::Save(const std::string &filename) const
+{
+    std::ofstream outStream(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!outStream.is_open())
+    {
+        std::cerr << "Error writing file " << filename << std::endl;
+        return false;
+    }
+    outStream.write((const char *)m_pData, m_size);
+    return outStream.good();
+}
+
+/// @brief Use a compiled database in place. Checks only the table bounds
+bool SymbolDb::Attach(const uint8_t *pData, size_t size, const std::string &filename)
+{
+    m_pData = pData;
+    m_size = size;
+    m_imageCount = 0;
+    m_symbolCount = 0;
+    m_pImages = NULL;
+    m_pSymbols = NULL;
+    m_pPool = "";
+    m_poolSize = 1;
+    m_image.first = m_image.count = 0;
+    m_global.first = m_global.count = 0;
+    if (pData == NULL)
+    {
+        return true;
+    }
+
+    uint64_t imageCount = (size >= HeaderSize) ? Get32(pData + 8) : 0;
+    uint64_t symbolCount = (size >= HeaderSize) ? Get32(pData + 12) : 0;
+    uint64_t poolOffset = (size >= HeaderSize) ? Get32(pData + 16) : 0;
+    uint64_t poolSize = (size >= HeaderSize) ? Get32(pData + 20) : 0;
+    if ((size < HeaderSize) || (memcmp(pData, "NPSY", 4) != 0) || (Get16(pData + 4) != FormatVersion) ||
+        (poolOffset != HeaderSize + (imageCount * ImageSize) + (symbolCount * SymbolSize)) ||
+        (poolSize == 0) || (poolOffset + poolSize > size) || (pData[poolOffset + poolSize - 1] != '\0'))
+    {
+        std::cerr << "Invalid symbol file '" << filename << "'\n";
+        Attach(NULL, 0, filename);
+        return false;
+    }
+
+    m_imageCount = (uint32_t)imageCount;
+    m_symbolCount = (uint32_t)symbolCount;
+    m_pImages = pData + HeaderSize;
+    m_pSymbols = m_pImages + (imageCount * ImageSize);
+    m_pPool = (const char *)(pData + poolOffset);
+    m_poolSize = (uint32_t)poolSize;
+    FindImage("*", m_global);
+    return true;
+}
+
+/// @brief Select the symbols of an image, by file name
+/// @return false if the image has no symbols of its own
+bool SymbolDb::SetImage(const std::string &image)
+{
+    if (!FindImage(image, m_image))
+    {
+        m_image.first = m_image.count = 0;
+        return false;
+    }
+    return true;
+}
+
+/// @brief Binary search of the image table
+bool SymbolDb::FindImage(const std::string &image, Span &span) const
+{
+    size_t low = 0;
+    size_t high = m_imageCount;
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        const uint8_t *p = m_pImages + (middle * ImageSize);
+        int order = strcmp(PoolString(Get32(p)), image.c_str());
+        if (order == 0)
+        {
+            span.first = Get32(p + 4);
+            span.count = Get32(p + 8);
+            // A damaged file may not point out of the symbol table
+            if ((span.first > m_symbolCount) || (span.count > m_symbolCount - span.first))
+            {
+                span.count = 0;
+            }
+            return true;
+        }
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+/// @brief First symbol of the span at or after 'address'
+size_t SymbolDb::LowerBound(const Span &span, size_t address) const
+{
+    size_t low = span.first;
+    size_t high = (size_t)span.first + span.count;
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if (Get16(m_pSymbols + (middle * SymbolSize)) < address)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void SymbolDb::GetSymbol(size_t i, Symbol &symbol) const
+{
+    const uint8_t *p = m_pSymbols + (i * SymbolSize);
+    symbol.address = Get16(p);
+    symbol.name = PoolString(Get32(p + 4));
+    symbol.comment = PoolString(Get32(p + 8));
+}
+
+const char *SymbolDb::PoolString(uint32_t offset) const
+{
+    return (offset < m_poolSize) ? m_pPool + offset : "";
+}
+
+/// @brief Symbol of an address. Image symbols hide '*' ones
+/// @return false if none
+bool SymbolDb::Find(uint16_t address, Symbol &symbol) const
+{
+    const Span *spans[2] = { &m_image, &m_global };
+    for (int s = 0; s < 2; s++)
+    {
+        size_t i = LowerBound(*spans[s], address);
+        if ((i < (size_t)spans[s]->first + spans[s]->count) && (Get16(m_pSymbols + (i * SymbolSize)) == address))
+        {
+            GetSymbol(i, symbol);
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief Symbols of the addresses from 'start' up to, not including, 'end'
+/// In address order. Image symbols hide '*' ones
+void SymbolDb::FindRange(size_t start, size_t end, std::vector<Symbol> &symbols) const
+{
+    symbols.clear();
+    size_t i = LowerBound(m_image, start);
+    size_t iEnd = (size_t)m_image.first + m_image.count;
+    size_t g = LowerBound(m_global, start);
+    size_t gEnd = (size_t)m_global.first + m_global.count;
+    Symbol symbol;
+    Symbol global;
+    while (true)
+    {
+        bool hasImage = (i < iEnd) && (Get16(m_pSymbols + (i * SymbolSize)) < end);
+        bool hasGlobal = (g < gEnd) && (Get16(m_pSymbols + (g * SymbolSize)) < end);
+        if (!hasImage && !hasGlobal)
+        {
+            break;
+        }
+        if (hasImage)
+        {
+            GetSymbol(i, symbol);
+        }
+        if (hasGlobal)
+        {
+            GetSymbol(g, global);
+        }
+        if (!hasImage || (hasGlobal && (global.address < symbol.address)))
+        {
+            symbols.push_back(global);
+            g++;
+            continue;
+        }
+        symbols.push_back(symbol);
+        i++;
+        if (hasGlobal && (global.address == symbol.address))
+        {
+            g++;
+        }
+    }
+}
@@ -0,0 +1,111 @@
+/* npd project: symboldb.h
+ * Copyright (C) 2023  Ricardo Fernandes Lopes
+ * 
+ * This file is part of 'npd' - A Nanoprocessor Disassembler.
+ *
+ * 'npd' is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by 
+ * the Free Software Foundation, either version 3 of the License, or 
+ * (at your option) any later version.
+ *
+ * 'npd' is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with 'npd'. If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/// @brief Named address of an image
+struct Symbol
+{
+    uint16_t address;
+    const char *name;     // "" for a comment only
+    const char *comment;  // "" for none
+};
+
+/// @brief Symbol and annotation database: names and comments of the
+/// addresses of many images
+///
+/// Text import, one symbol per line: 'IMAGE ADDRESS NAME [; COMMENT]'.
+/// IMAGE is the image file name, or '*' for every image. ADDRESS is
+/// decimal, 0x hexadecimal, or 0 octal. NAME '-' only adds the comment.
+/// Lines starting with '#' are comments.
+///
+/// Compiled file layout (version 1). All integers are little endian.
+///   Header (32 bytes)       "NPSY", u16 version, u16 reserved, u32 image count,
+///                           u32 symbol count, u32 pool offset, u32 pool size,
+///                           u32 reserved[2]
+///   Images (12 bytes)       u32 name offset, u32 first symbol, u32 symbol count.
+///                           Sorted by name
+///   Symbols (12 bytes)      u16 address, u16 reserved, u32 name offset,
+///                           u32 comment offset. Sorted by image, then address
+///   String pool             '\0' terminated strings. Offset 0 is ""
+///
+/// A compiled file is mapped in memory and searched in place: loading
+/// costs the same for any number of symbols. A text file is compiled in
+/// memory when loaded.
+class SymbolDb
+{
+public:
+    SymbolDb();
+    ~SymbolDb();
+
+    bool Load(const std::string &filename);
+    bool Import(const std::string &filename);
+    bool Save(const std::string &filename) const;
+
+    bool SetImage(const std::string &image);
+    bool Find(uint16_t address, Symbol &symbol) const;
+    void FindRange(size_t start, size_t end, std::vector<Symbol> &symbols) const;
+
+    size_t size() const { return m_symbolCount; };
+    size_t ImageCount() const { return m_imageCount; };
+
+    static constexpr uint16_t FormatVersion = 1;
+    static constexpr uint32_t HeaderSize = 32;
+    static constexpr uint32_t ImageSize = 12;
+    static constexpr uint32_t SymbolSize = 12;
+
+private:
+    // Symbols of an image: [first, first + count) of the symbol table
+    struct Span
+    {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    bool Attach(const uint8_t *pData, size_t size, const std::string &filename);
+    void Unmap();
+    bool FindImage(const std::string &image, Span &span) const;
+    size_t LowerBound(const Span &span, size_t address) const;
+    void GetSymbol(size_t i, Symbol &symbol) const;
+    const char *PoolString(uint32_t offset) const;
+
+private:
+    // Compiled database: a file mapping or m_buffer
+    const uint8_t *m_pData;
+    size_t m_size;
+    void *m_pMapping;
+    size_t m_mappingSize;
+    std::vector<uint8_t> m_buffer;
+
+    uint32_t m_imageCount;
+    uint32_t m_symbolCount;
+    const uint8_t *m_pImages;
+    const uint8_t *m_pSymbols;
+    const char *m_pPool;
+    uint32_t m_poolSize;
+
+    // Selected image and the '*' symbols of every image
+    Span m_image;
+    Span m_global;
+};